@@ -15,11 +15,35 @@
  Our example sets target position to 123 and starts motion on
  default axis with default speed.
 
+ Commands between q and e are queued and run when e arrives, e argument
+ is queue id reported back as qdone<id>. Next queue can be sent while one
+ runs, it starts right after the running one without stopping motors.
+ Commands come in frames: start byte 1, sequence number, payload length,
+ payload (up to FRAME_PAYLOAD command bytes) and CRC16 (CCITT, high byte
+ first) of sequence, length and payload. Stored frame is acked with
+ "ack<seq> <free>", corrupt one or one that does not fit in the receive
+ buffer gets "nak<seq> <free>" of the frame we expect, PC then sends
+ frames again from it. Free is space left in the receive buffer, PC sends
+ only frames that fit in it. When space frees up after reporting less
+ then a frame, last ack is sent again with the new space. Reports to PC
+ are sent between new lines.
+
+ Besides ASCII commands frames can have binary moves: byte OP_MOVE + bits
+ (1=x, 2=y, 4=z, 8=m) followed by x, y, z arguments as differences from
+ previous x, y, z arguments, zigzag encoded varints (7 bits per byte, low
+ bits first, high bit set if more bytes follow). V command resets the
+ previous arguments to 0 and reports PROTO_VERSION as version<n>.
+
 */
 
-#define MAX_CMDS 128
+#define MAX_CMDS 128              // running queue and the one sent after it
 #define MAX_DRIFTS 64
 #define MAX_VELS 2
+#define RX_LEN 64                 // received commands not parsed yet
+#define FRAME_START 1
+#define FRAME_PAYLOAD 16          // same as in cmdlink.h of PC side
+#define PROTO_VERSION 2           // 1=ASCII commands, 2=also binary moves
+#define OP_MOVE 0x80
 
 #define int32 long
 
@@ -58,12 +82,35 @@ int32 tdelaysZ[MAX_VELS];
 char cmd;                       // current command (a=axis, x,y,z=pos, r=driftx in current z, s=sdelayX, w=tdelayX, h=sdelayY, n=tdelayY, a=sdelayZ, q=tdelayZ, z=delay step, m=start motion, set current pos, q=queue start, e=execute queue)
 int32 arg;                      // argument for current commands
 
-char cmds[MAX_CMDS];            // queued commands
+char cmds[MAX_CMDS];            // queued commands, ring buffer
 int32 args[MAX_CMDS];           // arguments for queued commands
-int32 cmdIndex;
-int32 cmdCount;
+int32 cmdIndex;                 // next command to run
+int32 cmdCount;                 // commands left in running queue, -1 if no queue runs
 int32 queueId;
-
+int32 nextCount;                // commands of queue to run after current one, -1 if none
+int32 nextId;
+int32 loadCount;                // commands of queue being loaded, -1 if not between q and e
+
+char rx[RX_LEN];                // payloads of received frames, ring buffer
+int32 rxIndex;                  // next byte to parse
+int32 rxCount;
+
+int32 frameState;               // 0=start, 1=seq, 2=length, 3=payload, 4,5=crc
+int32 framePos;                 // payload bytes received
+byte frameSeq;
+byte frameLen;
+unsigned int frameCrc;          // computed
+unsigned int frameSent;         // received
+byte expectSeq;                 // sequence number of next frame
+bool frameDrop;                 // frame does not fit in rx, nak it
+int32 creditSent;               // free rx bytes last reported to PC
+
+char inCmd;                     // command being read from serial
+int32 inArg;
+int32 lastArg[3];               // last x, y, z argument read
+int32 binOp;                    // bits of binary move not read yet
+unsigned long varVal;           // varint being read
+int32 varShift;
 char b;
 char buf[9];
 int32 bufPos;
@@ -122,12 +169,104 @@ void zOff()
     digitalWrite(13, LOW);
 }
 
+// Send report to PC, between new lines so that it is not mistaken for
+// other reports
+void report(const char *msg, int32 val)
+{
+    Serial.print("\n");
+    Serial.print(msg);
+    Serial.print(val);
+    Serial.print("\n");
+}
+
+// Ack or nak frames with free space in rx, PC sends only frames that fit
+void reportAck(const char *msg, byte seq)
+{
+    creditSent = RX_LEN - rxCount;
+    Serial.print("\n");
+    Serial.print(msg);
+    Serial.print((int32) seq);
+    Serial.print(" ");
+    Serial.print(creditSent);
+    Serial.print("\n");
+}
+
+unsigned int crc16(unsigned int crc, byte c)
+{
+    crc ^= (unsigned int) c << 8;
+    for (int i = 0; i < 8; i++) {
+        crc = ((crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1)) & 0xffff;
+    }
+    return crc;
+}
+
+// Move received frames to rx and ack them. Called also between motor
+// steps so that PC can send next commands while motors run.
+void pollSerial()
+{
+    if (creditSent < FRAME_PAYLOAD && RX_LEN - rxCount >= FRAME_PAYLOAD) {
+        reportAck("ack", expectSeq - 1);        // PC waits for space
+    }
+    while (Serial.available()) {
+        byte c = Serial.read();
+        if (frameState == 0) {
+            if (c == FRAME_START) {
+                frameCrc = 0xffff;
+                frameState = 1;
+            }
+            continue;
+        }
+        if (frameState == 1) {
+            frameSeq = c;
+            frameCrc = crc16(frameCrc, c);
+            frameState = 2;
+            continue;
+        }
+        if (frameState == 2) {
+            frameLen = c;
+            frameCrc = crc16(frameCrc, c);
+            framePos = 0;
+            frameDrop = (frameLen > RX_LEN - rxCount);
+            frameState = (frameLen > FRAME_PAYLOAD ? 0 : (frameLen > 0 ? 3 : 4));
+            continue;
+        }
+        if (frameState == 3) {
+            if (!frameDrop) {
+                rx[(rxIndex + rxCount + framePos) % RX_LEN] = c;
+            }
+            frameCrc = crc16(frameCrc, c);
+            framePos++;
+            if (framePos == frameLen) {
+                frameState = 4;
+            }
+            continue;
+        }
+        if (frameState == 4) {
+            frameSent = (unsigned int) c << 8;
+            frameState = 5;
+            continue;
+        }
+        frameSent |= c;
+        frameState = 0;
+        if (frameSent != frameCrc || (frameSeq == expectSeq && frameDrop)) {
+            reportAck("nak", expectSeq);
+        } else if (frameSeq == expectSeq) {
+            rxCount += frameLen;
+            reportAck("ack", expectSeq);
+            expectSeq++;
+        } else {
+            reportAck("ack", expectSeq - 1);    // sent again, we have it
+        }
+    }
+}
+
 int32 delayAndCheckLimit(int32 delayUs, int32 tdelay, int32 axis, bool slow)
 {
     delayMicroseconds(delayUs);
     if(slow) {
         delayMicroseconds(delayUs);
     }
+    pollSerial();
 
     if (axis != 0 && lastAxis != 0 && lastAxis2 != 0) {
         delayX = sdelayX;
@@ -389,6 +528,133 @@ void drawLine(int32 x0, int32 y0, int32 x1, int32 y1)
     }
 }
 
+int32 cmdsQueued()
+{
+    return max(cmdCount, 0) + max(nextCount, 0) + max(loadCount, 0);
+}
+
+// Take command read from serial. Returns false if it has to wait until
+// running queue is done or frees some space.
+bool takeCmd()
+{
+    if (inCmd == 'q' || inCmd == 'e') {
+        if (nextCount >= 0) {
+            return false;       // two queues already, wait for the running one
+        }
+        if (inCmd == 'q') {
+            loadCount = max(loadCount, 0);      // start command queue
+        } else if (cmdCount >= 0) {
+            nextCount = max(loadCount, 0);      // run after current queue
+            nextId = inArg;
+            loadCount = -1;
+        } else {
+            cmdCount = max(loadCount, 0);       // execute command queue
+            queueId = inArg;
+            loadCount = -1;
+        }
+        inCmd = 0;
+        return true;
+    }
+    if (loadCount >= 0) {
+        if (cmdsQueued() >= MAX_CMDS) {
+            if (cmdCount >= 0) {
+                return false;
+            }
+            report("error: queue full ", loadCount);
+            inCmd = 0;
+            return true;
+        }
+        int32 i = (cmdIndex + cmdsQueued()) % MAX_CMDS;
+        cmds[i] = inCmd;
+        args[i] = inArg;
+        loadCount++;
+        inCmd = 0;
+        return true;
+    }
+    // other commands run when machine is idle
+    if (cmd != 0 || cmdCount >= 0) {
+        return false;
+    }
+    cmd = inCmd;
+    arg = inArg;
+    inCmd = 0;
+    return true;
+}
+
+// Parse received commands while they can be taken, also while queue runs
+// so that next queue is loaded before the running one is done
+void readCmds()
+{
+    pollSerial();
+    for (;;) {
+        if (inCmd != 0 && bufPos < 0 && !takeCmd()) {
+            return;
+        }
+        if (cmd != 0 && cmdCount < 0) {
+            return;             // run command first
+        }
+        if (inCmd == 0 && binOp == 8) {
+            inCmd = 'm';        // binary move ends with m
+            inArg = 0;
+            binOp = 0;
+            continue;
+        }
+        if (rxCount == 0) {
+            return;
+        }
+        b = rx[rxIndex];
+        rxIndex = (rxIndex + 1) % RX_LEN;
+        rxCount--;
+
+        // binary move, next axis difference
+        if (binOp != 0) {
+            varVal |= (unsigned long) (b & 0x7f) << varShift;
+            varShift += 7;
+            if (b & 0x80) {
+                continue;
+            }
+            int32 axis = (binOp & 1) ? 0 : ((binOp & 2) ? 1 : 2);
+            binOp &= ~(1 << axis);
+            lastArg[axis] += (int32) (varVal >> 1) ^ -(int32) (varVal & 1);
+            inCmd = 'x' + axis;
+            inArg = lastArg[axis];
+            varVal = 0;
+            varShift = 0;
+            continue;
+        }
+        if ((byte) b >= OP_MOVE) {
+            binOp = b & 0x0f;
+            varVal = 0;
+            varShift = 0;
+            continue;
+        }
+
+        // read command
+        if (inCmd == 0) {
+            inCmd = b;
+            inArg = 0x7fffffff;
+            bufPos = 0;
+            continue;
+        }
+        // read integer argument
+        if (b != ' ') {
+            if (bufPos < 8) {
+                buf[bufPos] = b;
+                bufPos++;
+            }
+            continue;
+        }
+        buf[bufPos] = '\0';
+        inArg = atol(buf);
+        bufPos = -1;
+        if (inCmd >= 'x' && inCmd <= 'z') {
+            lastArg[inCmd - 'x'] = inArg;
+        } else if (inCmd == 'V') {
+            lastArg[0] = lastArg[1] = lastArg[2] = 0;
+        }
+    }
+}
+
 void setDelays()
 {
     delayX = sdelayX = sdelaysX[vel];
@@ -430,9 +696,18 @@ void setup()
     Serial.begin(115200);
 
     cmd = 0;
-    cmdIndex = -1;
+    inCmd = 0;
+    cmdIndex = 0;
     cmdCount = -1;
+    nextCount = -1;
+    loadCount = -1;
     bufPos = -1;
+    rxIndex = rxCount = 0;
+    lastArg[0] = lastArg[1] = lastArg[2] = 0;
+    binOp = 0;
+    frameState = 0;
+    expectSeq = 0;
+    creditSent = RX_LEN;
     cx = cy = cz = tx = ty = tz = 0;
     memset(driftsX, 0, MAX_DRIFTS);
     memset(driftsZ, 0, MAX_DRIFTS);
@@ -455,88 +730,39 @@ void setup()
         limitsY[i] = -1;
     }
 
-    Serial.println("arduino init ok");
+    Serial.print("\narduino init ok\n");
 }
 
 void loop()
 {
-    if (cmd == 0 || bufPos >= 0) {
+    readCmds();
+
+    if (cmd == 0) {
         // read next command from queue
-        if (cmdIndex >= 0) {
-            if (cmdIndex >= cmdCount) {
-                Serial.print("qdone");
-                Serial.print(queueId);
-                cmdIndex = -1;  // queue executed
-                cmdCount = -1;
+        if (cmdCount >= 0) {
+            if (cmdCount == 0) {
+                report("qdone", queueId);
+                cmdCount = nextCount;   // start next queue right away
+                queueId = nextId;
+                nextCount = -1;
                 return;
             }
             cmd = cmds[cmdIndex];
             arg = args[cmdIndex];
-            cmdIndex++;
-//            Serial.print(cmd);
-//            Serial.print(" ");
-//            Serial.print(arg);
+            cmdIndex = (cmdIndex + 1) % MAX_CMDS;
+            cmdCount--;
             return;
         }
         // if not moving, stop current on all motor wirings and reset delays
-        if (cmd == 0) {
-            xOff();
-            yOff();
-            zOff();
-
-            delayX = sdelayX;
-            delayY = sdelayY;
-            delayZ = sdelayZ;
-            lastAxis = lastAxis2 = -1;
-        }
-        // check if data has been sent from the computer:
-        if (!Serial.available()) {
-            return;
-        }
-        // read command
-        if (cmd == 0) {
-            cmd = Serial.read();
-            Serial.write(cmd);
-            arg = 0x7fffffff;
-            bufPos = 0;
-            return;
-        }
-        // read integer argument
-        b = Serial.read();
-        Serial.write(b);
-
-        if (b != ' ') {
-            buf[bufPos] = b;
-            bufPos++;
-            return;
-        }
-        buf[bufPos] = '\0';
-        arg = atol(buf);
-        bufPos = -1;
-
-//        Serial.print("command ");
-//        Serial.print(cmd);
-//        Serial.print(" ");
-//        Serial.println(arg);
+        xOff();
+        yOff();
+        zOff();
 
-        if (cmd == 'q') {
-            cmdCount = 0;       // start command queue
-            cmd = 0;
-            return;
-        }
-        if (cmd == 'e') {
-            queueId = arg;
-            cmdIndex = 0;       // execute command queue
-            cmd = 0;
-            return;
-        }
-        if (cmdCount >= 0) {
-            cmds[cmdCount] = cmd;
-            args[cmdCount] = arg;
-            cmdCount++;
-            cmd = 0;
-            return;
-        }
+        delayX = sdelayX;
+        delayY = sdelayY;
+        delayZ = sdelayZ;
+        lastAxis = lastAxis2 = -1;
+        return;
     }
     // motion handling
     if (cmd == 'M') {
@@ -553,18 +779,14 @@ void loop()
         if (cx != tx + currDriftX || cy != ty) {
             drawLine(cx, cy, tx + currDriftX, ty);
         }
-        if (cmdIndex < 0) {
-            Serial.print("done");
-            Serial.print(arg);
+        if (cmdCount < 0) {
+            report("done", arg);
         }
         cmd = 0;                // we are done, read next command from serial/queue
         return;
     }
 
     if (cmd == 'm') {
-        if (cmdCount >= 0 && cmdIndex < 0) {    // dont execute if queueing
-            return;
-        }
         cmd = 'M';
         return;
     }
@@ -586,7 +808,7 @@ void loop()
 
     } else if (cmd == 'r') {
         if (arg >= MAX_DRIFTS) {
-            Serial.print("max drifts reached!");
+            report("max drifts reached! ", arg);
         } else {
             lastDrift = arg;
             driftsX[lastDrift] = tx;
@@ -609,9 +831,12 @@ void loop()
     } else if (cmd == 'v') {
         vel = arg;
         setDelays();
+    } else if (cmd == 'V') {
+        report("version", PROTO_VERSION);
     } else {
-        Serial.print("error: unknown command ");
-        Serial.println(cmd);
+        Serial.print("\nerror: unknown command ");
+        Serial.print(cmd);
+        Serial.print("\n");
     }
     cmd = 0;
 }
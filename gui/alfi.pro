@@ -10,12 +10,44 @@ TEMPLATE = app
 
 SOURCES += main.cpp\
         mainwindow.cpp \
+    cmdcodec.cpp \
+    cmdlink.cpp \
+    geomcache.cpp \
+    jobplanner.cpp \
+    machinecost.cpp \
+    machinelink.cpp \
+    offset.cpp \
+    optimizer.cpp \
+    planner.cpp \
+    polyline.cpp \
     qserialiodevice.cpp \
-    qserialport.cpp
+    qserialport.cpp \
+    segmentindex.cpp \
+    segmentstore.cpp \
+    segmenttransform.cpp \
+    svgnumber.cpp \
+    svgreader.cpp \
+    svgwriter.cpp
 
 HEADERS  += mainwindow.h \
+    cmdcodec.h \
+    cmdlink.h \
+    geomcache.h \
+    jobplanner.h \
+    machinecost.h \
+    machinelink.h \
+    offset.h \
+    optimizer.h \
+    planner.h \
+    polyline.h \
     qserialiodevice_p.h \
     qserialiodevice.h \
-    qserialport.h
+    qserialport.h \
+    segmentindex.h \
+    segmentstore.h \
+    segmenttransform.h \
+    svgnumber.h \
+    svgreader.h \
+    svgwriter.h
 
 FORMS    += mainwindow.ui
@@ -0,0 +1,46 @@
+#-------------------------------------------------
+#
+# Console benchmarks of the milling front end (no GUI)
+#
+#-------------------------------------------------
+
+TARGET = bench
+TEMPLATE = app
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+DEFINES += SRCDIR=\\\"$$PWD\\\"
+
+SOURCES += main.cpp \
+    firmwaresim.cpp \
+    orderbench.cpp \
+    ../jobplanner.cpp \
+    ../machinecost.cpp \
+    ../offset.cpp \
+    ../optimizer.cpp \
+    ../planner.cpp \
+    ../polyline.cpp \
+    ../segmentindex.cpp \
+    ../segmentstore.cpp \
+    ../segmenttransform.cpp \
+    ../svgnumber.cpp \
+    ../svgreader.cpp \
+    ../svgwriter.cpp
+
+HEADERS += firmwaresim.h \
+    orderbench.h \
+    random.h \
+    ../jobplanner.h \
+    ../machinecost.h \
+    ../offset.h \
+    ../optimizer.h \
+    ../planner.h \
+    ../polyline.h \
+    ../segmentindex.h \
+    ../segmentstore.h \
+    ../segmenttransform.h \
+    ../svgnumber.h \
+    ../svgreader.h \
+    ../svgwriter.h
@@ -0,0 +1,182 @@
+#include "firmwaresim.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "machinecost.h"
+#include "random.h"
+
+FirmwareSim::FirmwareSim(long sdelayXY, long tdelayXY, long sdelayZ,
+                         long tdelayZ, long delayStep)
+:  cx(0), cy(0), cz(0), sdelayX(sdelayXY), tdelayX(tdelayXY),
+   delayX(sdelayXY), sdelayY(sdelayXY), tdelayY(tdelayXY),
+   delayY(sdelayXY), sdelayZ(sdelayZ), tdelayZ(tdelayZ), delayZ(sdelayZ),
+   delayStep(delayStep), lastAxis(-1), lastAxis2(-1), currDirX(0),
+   currDirY(0), lastDirX(0), lastDirY(0), total(0)
+{
+}
+
+void FirmwareSim::idle()
+{
+    delayX = sdelayX;
+    delayY = sdelayY;
+    delayZ = sdelayZ;
+    lastAxis = lastAxis2 = -1;
+}
+
+long FirmwareSim::delayAndCheckLimit(long delayUs, long tdelay, long axis)
+{
+    total += delayUs;
+
+    if (axis != 0 && lastAxis != 0 && lastAxis2 != 0) {
+        delayX = sdelayX;
+    }
+    if (axis != 1 && lastAxis != 1 && lastAxis2 != 1) {
+        delayY = sdelayY;
+    }
+    if (axis != 2 && lastAxis != 2 && lastAxis2 != 2) {
+        delayZ = sdelayZ;
+    }
+    if ((lastAxis == axis || lastAxis2 == axis) && delayUs > tdelay) {
+        delayUs -= delayStep;
+    }
+    lastAxis2 = lastAxis;
+    lastAxis = axis;
+    return delayUs;
+}
+
+void FirmwareSim::drawLine(long x0, long y0, long x1, long y1)
+{
+    currDirX = x0 > x1;
+    currDirY = y0 > y1;
+    if (currDirX != lastDirX) {
+        delayX = sdelayX;
+    }
+    if (currDirY != lastDirY) {
+        delayY = sdelayY;
+    }
+    lastDirX = currDirX;
+    lastDirY = currDirY;
+
+    long dx = labs(x1 - x0);
+    long dy = labs(y1 - y0);
+    long sx = (x0 < x1 ? 1 : -1);
+    long sy = (y0 < y1 ? 1 : -1);
+    long err = dx - dy;
+    long e2;
+
+    for (;;) {
+        if (cx != x0) {
+            cx = x0;
+            delayX = delayAndCheckLimit(delayX, tdelayX, 0);
+        }
+        if (cy != y0) {
+            cy = y0;
+            delayY = delayAndCheckLimit(delayY, tdelayY, 1);
+        }
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        e2 = 2 * err;
+        if (e2 > -dy) {
+            err = err - dy;
+            x0 = x0 + sx;
+        }
+        if (e2 < dx) {
+            err = err + dx;
+            y0 = y0 + sy;
+        }
+    }
+}
+
+double FirmwareSim::move(long dx, long dy, long dz)
+{
+    double start = total;
+    long tz = cz + dz;
+    while (cz < tz) {
+        cz++;
+        delayZ = delayAndCheckLimit(delayZ, tdelayZ, 2);
+    }
+    while (cz > tz) {
+        cz--;
+        delayZ = delayAndCheckLimit(delayZ, tdelayZ, 2);
+    }
+    if (dx != 0 || dy != 0) {
+        drawLine(cx, cy, cx + dx, cy + dy);
+    }
+    return total - start;
+}
+
+// Estimate of a sequence may be off by this many percent
+#define COST_TOLERANCE 2.0
+
+int checkMachineCost()
+{
+    // Delays MainWindow uses
+    MachineParams params;
+    params.sdelayX = params.sdelayY = 3600;
+    params.tdelayX = params.tdelayY = 2400;
+    params.sdelayZ = 8000;
+    params.tdelayZ = 4000;
+    MachineCost machine(params);
+
+    // Longest moves of the sequence kinds, short ones flip direction often
+    const char *names[] = { "long", "medium", "short", "flipping" };
+    long ranges[] = { 2000, 200, 40, 6 };
+    quint64 seed = 1;
+    int failures = 0;
+    for (int kind = 0; kind < 4; kind++) {
+        double worst = 0;
+        double sum = 0;
+        int sequences = 2000;
+        for (int i = 0; i < sequences; i++) {
+            FirmwareSim sim(3600, 2400, 8000, 4000, 50);
+            MachineCost::State state;
+            machine.reset(state);
+            double simUs = 0;
+            double costUs = 0;
+            long r = ranges[kind];
+            int moves = 1 + (int) ((nextRandom(seed) >> 33) % 30);
+            for (int j = 0; j < moves; j++) {
+                long d[4];
+                for (int k = 0; k < 4; k++) {
+                    d[k] = (long) ((nextRandom(seed) >> 33) % (2 * r + 1)) -
+                        r;
+                }
+                // Some moves are axis parallel, some go along z or are a
+                // queue of their own
+                long dz = (d[3] % 7 == 0 ? d[3] : 0);
+                if (d[3] % 5 == 0) {
+                    d[1] = d[1] % 2;
+                }
+                if (d[3] % 11 == 0) {
+                    sim.idle();
+                    machine.reset(state);
+                }
+                simUs += sim.move(d[0], d[1], dz);
+                costUs += machine.lineZ(state, dz);
+                costUs += machine.line(state, d[0], d[1]);
+            }
+            if (simUs <= 0) {
+                continue;
+            }
+            double err = 100 * fabs(costUs - simUs) / simUs;
+            if (err > COST_TOLERANCE) {
+                if (failures < 10) {
+                    printf("machine cost %s sequence %d moves=%d "
+                           "firmware_us=%.0f cost_us=%.0f\n", names[kind], i,
+                           moves, simUs, costUs);
+                }
+                failures++;
+            }
+            worst = (err > worst ? err : worst);
+            sum += err;
+        }
+        printf("machine cost %s sequences=%d mean_err=%.2f%% "
+               "worst_err=%.2f%% tolerance=%.1f%%\n", names[kind], sequences,
+               sum / sequences, worst, COST_TOLERANCE);
+    }
+    printf("machine cost failures=%d\n", failures);
+    return failures;
+}
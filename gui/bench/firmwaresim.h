@@ -0,0 +1,40 @@
+#ifndef FIRMWARESIM_H
+#define FIRMWARESIM_H
+
+#include <QtGlobal>
+
+// Step timing of alfi_arduino.ino: drawLine(), the z loop of command 'M'
+// and delayAndCheckLimit() copied without pins, serial and limit switches.
+// Adds up the delays of all steps.
+class FirmwareSim
+{
+public:
+    FirmwareSim(long sdelayXY, long tdelayXY, long sdelayZ, long tdelayZ,
+                long delayStep);
+
+    // Machine idle between queues, delays back at their start
+    void idle();
+
+    // Move by dx, dy, dz steps like command 'M' does, returns microseconds
+    double move(long dx, long dy, long dz);
+
+private:
+    long cx, cy, cz;
+    long sdelayX, tdelayX, delayX;
+    long sdelayY, tdelayY, delayY;
+    long sdelayZ, tdelayZ, delayZ;
+    long delayStep;
+    long lastAxis, lastAxis2;
+    long currDirX, currDirY, lastDirX, lastDirY;
+    double total;
+
+    long delayAndCheckLimit(long delayUs, long tdelay, long axis);
+    void drawLine(long x0, long y0, long x1, long y1);
+};
+
+// Compare MachineCost with FirmwareSim on random move sequences, from long
+// lines to short ones that flip direction. Returns number of sequences
+// whose estimate is off by more then the tolerance.
+int checkMachineCost();
+
+#endif // FIRMWARESIM_H
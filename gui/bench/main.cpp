@@ -0,0 +1,925 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QStringList>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "firmwaresim.h"
+#include "jobplanner.h"
+#include "machinecost.h"
+#include "offset.h"
+#include "optimizer.h"
+#include "orderbench.h"
+#include "planner.h"
+#include "polyline.h"
+#include "random.h"
+#include "segmentindex.h"
+#include "segmentstore.h"
+#include "segmenttransform.h"
+#include "svgnumber.h"
+#include "svgreader.h"
+#include "svgwriter.h"
+
+// Stores segments to compare them with written ones
+class StoreSink : public SvgSegmentSink
+{
+public:
+    SegmentStore segs;
+
+    bool addSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2)
+    {
+        return segs.append(x1, y1, x2, y2);
+    }
+};
+
+// Just counts the segments so that we measure parsing only
+class CountSink : public SvgSegmentSink
+{
+public:
+    qint64 count;
+    qint64 sum;
+
+    CountSink()
+    :  count(0), sum(0)
+    {
+    }
+
+    bool addSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2)
+    {
+        count++;
+        sum += x1 ^ y1 ^ x2 ^ y2;       // keep the compiler from dropping it
+        return true;
+    }
+};
+
+// Parse svg file from memory repeatedly and print throughput
+static void benchSvg(const QString & path, int iterations)
+{
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly)) {
+        printf("svg %s error=\"%s\"\n", qPrintable(path),
+               qPrintable(f.errorString()));
+        return;
+    }
+    QByteArray data = f.readAll();
+    f.close();
+
+    CountSink sink;
+    SvgReader reader(&sink);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; i++) {
+        reader.read(data.constData(), data.size());
+    }
+    qint64 ns = timer.nsecsElapsed();
+
+    // Whole file including mmap
+    timer.restart();
+    reader.readFile(path);
+    qint64 fileNs = timer.nsecsElapsed();
+
+    double secs = ns / 1e9;
+    printf("svg %s bytes=%d paths=%d segments=%d iterations=%d "
+           "ns_per_file=%lld mb_per_s=%.1f segments_per_s=%.0f "
+           "read_file_ns=%lld\n",
+           qPrintable(path), data.size(), reader.pathCount(),
+           reader.segmentCount(), iterations, ns / iterations,
+           (data.size() * (double) iterations) / secs / 1e6,
+           (sink.count / secs), fileNs);
+}
+
+// Parse a buffer of numbers in the formats found in inkscape output
+static void benchNumbers(int iterations)
+{
+    const char *samples[] = {
+        "831.36408", "-0.5", "7.401", "1e-4", "-4.5e-4", "215.07874",
+        "-11.4365251", "2.27e-4", "0", "1013.1582", "-30.963", "158.327568",
+    };
+    int sampleCount = sizeof(samples) / sizeof(samples[0]);
+
+    QByteArray data;
+    for (int i = 0; i < 10000; i++) {
+        data.append(samples[i % sampleCount]);
+        data.append(' ');
+    }
+
+    qint64 numbers = 0;
+    qint64 sum = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; i++) {
+        const char *p = data.constData();
+        const char *end = p + data.size();
+        while (p < end) {
+            qint64 val;
+            if (parseSvgNumber(p, end, val)) {
+                sum += val;
+                numbers++;
+            }
+            p++;                // skip space
+        }
+    }
+    qint64 ns = timer.nsecsElapsed();
+    printf("numbers count=%lld ns_per_number=%.2f mb_per_s=%.1f sum=%lld\n",
+           numbers, ns / (double) numbers,
+           (data.size() * (double) iterations) / (ns / 1e9) / 1e6, sum);
+}
+
+// Bounds and mirror transform of a large random layer. Checks results
+// against plain loop, returns number of failures.
+static int benchTransform(int segments, int iterations)
+{
+    SegmentStore segs;
+    segs.reserve(segments);
+    quint64 seed = 7;
+    for (int i = 0; i < segments; i++) {
+        qint64 v[4];
+        for (int j = 0; j < 4; j++) {
+            v[j] = (qint64) (nextRandom(seed) >> 44) - 500000;
+        }
+        segs.append(v[0], v[1], v[2], v[3]);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    SegmentBounds bounds;
+    for (int i = 0; i < iterations; i++) {
+        bounds = segmentBounds(segs);
+    }
+    qint64 boundsNs = timer.nsecsElapsed() / iterations;
+
+    SegmentTransform t;
+    t.scaleX = -1;
+    t.offsetX = bounds.maxX;
+    t.offsetY = -bounds.minY;
+    SegmentStore orig = segs;
+    SegmentBounds res;
+    QString error;
+    qint64 transformNs = 0;
+    for (int i = 0; i < iterations; i++) {
+        // Copy and detach outside of the timed kernel
+        segs = orig;
+        segs.x1.data();
+        segs.y1.data();
+        segs.x2.data();
+        segs.y2.data();
+        timer.restart();
+        transformSegments(segs, t, bounds, res, error);
+        transformNs += timer.nsecsElapsed();
+    }
+    transformNs /= iterations;
+
+    int failures = 0;
+    SegmentBounds check;
+    for (int i = 0; i < segments; i++) {
+        qint64 x1 = orig.x1[i] * t.scaleX + t.offsetX;
+        qint64 y1 = orig.y1[i] * t.scaleY + t.offsetY;
+        qint64 x2 = orig.x2[i] * t.scaleX + t.offsetX;
+        qint64 y2 = orig.y2[i] * t.scaleY + t.offsetY;
+        check.add(x1, y1);
+        check.add(x2, y2);
+        if (segs.x1[i] != x1 || segs.y1[i] != y1 || segs.x2[i] != x2 ||
+            segs.y2[i] != y2) {
+            failures++;
+        }
+    }
+    if (check.minX != res.minX || check.maxX != res.maxX ||
+        check.minY != res.minY || check.maxY != res.maxY) {
+        failures++;
+    }
+
+    double bytes = segments * 16.0;
+    printf("transform kernel=%s segments=%d bounds_ns=%lld bounds_mb_per_s=%.0f "
+           "transform_ns=%lld transform_mb_per_s=%.0f failures=%d\n",
+           segmentKernelName(), segments, boundsNs,
+           bytes / (boundsNs / 1e9) / 1e6, transformNs,
+           bytes / (transformNs / 1e9) / 1e6, failures);
+    return failures;
+}
+
+// Write closed chains with SvgWriter and with the QString + num2svg code it
+// replaced, read the result back and compare. Returns number of failures.
+static int benchWriter(int segments)
+{
+    SegmentStore segs;
+    segs.reserve(segments);
+    quint64 seed = 11;
+    qint64 x = 0;
+    qint64 y = 0;
+    qint64 sx = 0;
+    qint64 sy = 0;
+    for (int i = 0; i < segments; i++) {
+        qint64 nx;
+        qint64 ny;
+        if (i % 100 == 99) {
+            nx = sx;            // close the chain
+            ny = sy;
+        } else {
+            quint64 r = nextRandom(seed);
+            nx = x + (qint64) ((r >> 33) % 20001) - 10000;
+            ny = y + (qint64) ((r >> 13) % 20001) - 10000;
+        }
+        segs.append(x, y, nx, ny);
+        x = nx;
+        y = ny;
+        if (i % 100 == 99) {
+            x += 50000;         // gap to the next chain
+            sx = x;
+            sy = y;
+        }
+    }
+
+    QString path = QDir::tempPath() + "/alfi_bench.svg";
+    QFile f(path);
+    f.open(QFile::WriteOnly | QFile::Truncate);
+    QElapsedTimer timer;
+    timer.start();
+    SvgWriter writer(&f);
+    writer.beginGroup("fill:none;stroke:#000000");
+    writer.writeSegments(segs);
+    writer.endGroup();
+    writer.flush();
+    qint64 ns = timer.nsecsElapsed();
+    qint64 size = writer.bytesWritten();
+    int paths = writer.pathCount();
+    f.close();
+
+    // One path with style per segment as on_bMillPath_clicked used to do
+    timer.restart();
+    QString str;
+    for (int i = 0; i < segs.count(); i++) {
+        qint64 cx = segs.x1[i];
+        qint64 cy = segs.y1[i];
+        str.append("<path d=\"m ");
+        str.append(num2svg(cx) + "," + num2svg(cy) + " " +
+                   num2svg(segs.x2[i] - cx) + "," + num2svg(segs.y2[i] - cy));
+        str.append("\"\nstyle=\"fill:none;stroke:#000000\"\n");
+        str.append("id=\"path" + QString::number(cx + cy) + "\"\n");
+        str.append("/>\n\n");
+    }
+    QByteArray old = str.toLatin1();
+    qint64 oldNs = timer.nsecsElapsed();
+
+    int failures = 0;
+    StoreSink sink;
+    SvgReader reader(&sink);
+    reader.readFile(path);
+    if (sink.segs.count() != segs.count()) {
+        failures++;
+    } else {
+        for (int i = 0; i < segs.count(); i++) {
+            if (sink.segs.x1[i] != segs.x1[i] ||
+                sink.segs.y1[i] != segs.y1[i] ||
+                sink.segs.x2[i] != segs.x2[i] ||
+                sink.segs.y2[i] != segs.y2[i]) {
+                failures++;
+            }
+        }
+    }
+    QFile::remove(path);
+
+    printf("writer segments=%d paths=%d bytes=%lld ns=%lld "
+           "old_bytes=%d old_ns=%lld failures=%d\n", segments, paths, size,
+           ns, old.size(), oldNs, failures);
+    return failures;
+}
+
+// Greedy nearest neighbour order as millShape() does it, with linear
+// search (the original code) or with SegmentIndex. Order is stored as
+// segment index, negative (-1 - index) for reversed segments.
+static void greedyOrder(const SegmentStore & segs, bool useIndex,
+                        QVector<int> & order)
+{
+    const qint32 *x1 = segs.x1.constData();
+    const qint32 *y1 = segs.y1.constData();
+    const qint32 *x2 = segs.x2.constData();
+    const qint32 *y2 = segs.y2.constData();
+    int count = segs.count();
+
+    order.clear();
+    SegmentMarks done;
+    done.resize(count);
+    SegmentIndex index;
+    if (useIndex) {
+        index.build(segs);
+    }
+    qint64 tx = 0;
+    qint64 ty = 0;
+    for (;;) {
+        int nindex = -1;
+        bool swap = false;
+        if (useIndex) {
+            nindex = index.nearest(tx, ty, swap);
+        } else {
+            qint64 ndist = 0x7fffffffffffffffLL;
+            for (int i = 0; i < count; i++) {
+                qint64 w = x1[i] - tx;
+                qint64 h = y1[i] - ty;
+                qint64 dist1 = w * w + h * h;
+                w = x2[i] - tx;
+                h = y2[i] - ty;
+                qint64 dist2 = w * w + h * h;
+                qint64 dist = (dist1 < dist2 ? dist1 : dist2);
+                if (dist > ndist || done.isMarked(i)) {
+                    continue;
+                }
+                ndist = dist;
+                nindex = i;
+                swap = (dist2 < dist1);
+            }
+        }
+        if (nindex < 0) {
+            break;
+        }
+        done.mark(nindex);
+        if (useIndex) {
+            index.remove(nindex);
+        }
+        order.append(swap ? -1 - nindex : nindex);
+        tx = swap ? x1[nindex] : x2[nindex];
+        ty = swap ? y1[nindex] : y2[nindex];
+    }
+}
+
+// Order a layer of short random traces (polylines of 8 segments and
+// pads) with the linear search, with SegmentIndex and with LayerPlanner,
+// they must all give the same order. Returns number of failures.
+static int benchOrder(int segments, bool linear)
+{
+    SegmentStore segs;
+    quint64 seed = 3;
+    qint64 x = 0;
+    qint64 y = 0;
+    for (int i = 0; i < segments; i++) {
+        if (i % 8 == 0) {
+            quint64 r = nextRandom(seed);
+            x = (r >> 40) % 300000;
+            y = (r >> 16) % 200000;
+        }
+        quint64 r = nextRandom(seed);
+        qint64 dx = (qint64) ((r >> 40) % 4001) - 2000;
+        qint64 dy = (qint64) ((r >> 16) % 4001) - 2000;
+        if (i % 56 == 0) {
+            dx = dy = 0;        // pads are points
+        }
+        segs.append(x, y, x + dx, y + dy);
+        x += dx;
+        y += dy;
+    }
+
+    QVector<int> greedy;
+    QElapsedTimer timer;
+    timer.start();
+    greedyOrder(segs, true, greedy);
+    qint64 indexNs = timer.nsecsElapsed();
+
+    timer.restart();
+    LayerPlanner planner(segs);
+    LayerPlan plan;
+    planner.plan(0, 0, false, plan);
+    qint64 planNs = timer.nsecsElapsed();
+
+    int failures = (greedy.count() != segments ? 1 : 0);
+    failures += (plan.steps != greedy ? 1 : 0);
+    qint64 linearNs = 0;
+    if (linear) {
+        QVector<int> slow;
+        timer.restart();
+        greedyOrder(segs, false, slow);
+        linearNs = timer.nsecsElapsed();
+        failures += (slow != greedy ? 1 : 0);
+    }
+    printf("order segments=%d chains=%d rapids=%d plan_ms=%.2f index_ms=%.2f "
+           "linear_ms=%.2f failures=%d\n", segments, plan.chainStarts.count(),
+           plan.rapids, planNs / 1e6, indexNs / 1e6, linearNs / 1e6,
+           failures);
+
+    // Optimized plan must still cut every segment once
+    timer.restart();
+    MachineCost machine;
+    double distBefore = ChainOptimizer::rapidDistance(segs, plan, 0, 0);
+    ChainOptimizer optimizer(segs, machine);
+    optimizer.optimize(0, 0, false, 1000, plan);
+    double distAfter = ChainOptimizer::rapidDistance(segs, plan, 0, 0);
+    qint64 optNs = timer.nsecsElapsed();
+    QVector<int> cut(segments, 0);
+    for (int i = 0; i < plan.steps.count(); i++) {
+        cut[LayerPlan::segment(plan.steps[i])]++;
+    }
+    int optFailures = (plan.steps.count() != segments ? 1 : 0);
+    for (int i = 0; i < segments; i++) {
+        optFailures += (cut[i] != 1 ? 1 : 0);
+    }
+    printf("optimize segments=%d rapids=%d rapid_before=%.0f "
+           "rapid_after=%.0f rapid_s_before=%.1f rapid_s_after=%.1f "
+           "opt_ms=%.2f failures=%d\n", segments, plan.rapids, distBefore,
+           distAfter, optimizer.before() / 1e6, optimizer.after() / 1e6,
+           optNs / 1e6, optFailures);
+    return failures + optFailures;
+}
+
+// Square outline of size d at x, y as four segments
+static void appendSquare(SegmentStore & segs, qint64 x, qint64 y, qint64 d)
+{
+    segs.append(x, y, x + d, y);
+    segs.append(x + d, y, x + d, y + d);
+    segs.append(x + d, y + d, x, y + d);
+    segs.append(x, y + d, x, y);
+}
+
+// Small layer of 40 squares on a grid must be optimized in less then a
+// quarter of the budget, search stops when perturbations do not help any
+// more. Returns number of failures.
+static int benchSmallLayer()
+{
+    SegmentStore segs;
+    for (int i = 0; i < 40; i++) {
+        appendSquare(segs, (i * 7 % 40) * 10000, (i % 5) * 30000, 5000);
+    }
+    LayerPlanner planner(segs);
+    LayerPlan plan;
+    planner.plan(0, 0, false, plan);
+
+    QElapsedTimer timer;
+    timer.start();
+    MachineCost machine;
+    ChainOptimizer optimizer(segs, machine);
+    optimizer.optimize(0, 0, false, 1000, plan);
+    qint64 ns = timer.nsecsElapsed();
+    int failures = (ns > 250 * 1000000LL ? 1 : 0);
+    failures += (optimizer.after() > optimizer.before() ? 1 : 0);
+    printf("small layer chains=%d budget_ms=1000 opt_ms=%.2f failures=%d\n",
+           plan.chainStarts.count(), ns / 1e6, failures);
+    return failures;
+}
+
+// Job of on_bMill_clicked() on its svg layers with the delays MainWindow
+// uses. Checks that the planned job mills every layer on every level once
+// and that it is faster then milling the operations whole in the given
+// order. Returns number of failures.
+static int benchJob()
+{
+    const char *names[] = { "pcb_milling.svg", "shape_milling.svg",
+                            "lcm_milling.svg", "lcd_milling.svg",
+                            "lcd_prepare.svg" };
+    QVector<SegmentStore> segs(5);
+    QVector<LayerPlan> plans(5);
+    for (int i = 0; i < segs.count(); i++) {
+        SvgParseOptions options;
+        StoreSink sink;
+        PolylineSimplifier simplifier(&sink, options.simplifyTolerance);
+        SvgReader reader(&simplifier, options);
+        bool ok = reader.readFile(QString(SRCDIR "/../") + names[i]);
+        simplifier.finish();
+        if (!ok || sink.segs.isEmpty()) {
+            printf("job %s error=\"%s\"\n", names[i],
+                   qPrintable(reader.errorString()));
+            return 1;
+        }
+        segs[i] = sink.segs;
+    }
+    qint64 x = segs[1].x1[0];
+    qint64 y = segs[1].y1[0];
+    for (int i = 0; i < segs.count(); i++) {
+        LayerPlanner planner(segs[i]);
+        planner.plan(x, y, true, plans[i]);
+    }
+
+    MachineParams params;
+    params.sdelayX = params.sdelayY = 3600;
+    params.tdelayX = params.tdelayY = 2400;
+    params.sdelayZ = 8000;
+    params.tdelayZ = 4000;
+    QElapsedTimer timer;
+    timer.start();
+    MachineCost machine(params);
+    JobPlanner job(machine);
+    job.addOperation(1, segs[1], plans[1], 0, 1);
+    job.addOperation(0, segs[0], plans[0], -1, 13);
+    job.addOperation(2, segs[2], plans[2], -1, 21);
+    int lcp = job.addOperation(4, segs[4], plans[4], -1, 5);
+    int lcd = job.addOperation(3, segs[3], plans[3], 1, 29);
+    job.setAfter(lcd, lcp);
+    job.setOutline(job.addOperation(1, segs[1], plans[1], -1, 35));
+    QVector<JobStep> steps;
+    job.plan(x, y, 0, steps);
+    qint64 ns = timer.nsecsElapsed();
+
+    // Every (layer, level) once, lcd right after lcp and outline last
+    int failures = 0;
+    QVector<int> seen(5 * 40, 0);
+    int lastLcp = -1;
+    int firstLcd = -1;
+    for (int i = 0; i < steps.count(); i++) {
+        seen[steps[i].layer * 40 + steps[i].level + 2]++;
+        if (steps[i].layer == 4) {
+            lastLcp = i;
+        }
+        if (steps[i].layer == 3 && firstLcd < 0) {
+            firstLcd = i;
+        }
+    }
+    int expected[5][2] = { {-1, 13}, {-1, 35}, {-1, 21}, {1, 29}, {-1, 5} };
+    for (int layer = 0; layer < 5; layer++) {
+        for (int level = -2; level < 38; level++) {
+            bool in = (level >= expected[layer][0] &&
+                       level <= expected[layer][1]);
+            failures += (seen[layer * 40 + level + 2] != (in ? 1 : 0));
+        }
+    }
+    failures += (firstLcd != lastLcp + 1 ? 1 : 0);
+    failures += (steps.last().layer != 1 || steps.last().level != 35);
+    failures += (job.cost() >= job.givenOrderCost() ? 1 : 0);
+    printf("job passes=%d z_levels=%d time_s=%.0f given_time_s=%.0f ns=%lld "
+           "failures=%d\n", steps.count(), job.zLevels(), job.cost() / 1e6,
+           job.givenOrderCost() / 1e6, ns, failures);
+    return failures;
+}
+
+// Check that parseSvgNumber(num2svg(n)) == n and some exact conversions.
+// Returns number of failures.
+static int checkNumbers()
+{
+    struct {
+        const char *str;
+        qint64 val;
+    } exact[] = {
+        { "-0.5", -500 }, { "0.5", 500 }, { "-.5", -500 }, { "+2", 2000 },
+        { "1e-4", 0 }, { "-4.5e-4", 0 }, { "5e-4", 1 }, { "-5e-4", -1 },
+        { "0.0005", 1 }, { "-0.0004999", 0 }, { "1.2345e2", 123450 },
+        { "2.8245243", 2825 }, { "1E3", 1000000 }, { "12.", 12000 },
+        { "0.00049999999999999999999", 0 }, { "-831.36408", -831364 },
+    };
+    int failures = 0;
+    for (unsigned i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+        const char *p = exact[i].str;
+        qint64 val = 0;
+        if (!parseSvgNumber(p, p + strlen(p), val) || val != exact[i].val) {
+            printf("check %s expected=%lld got=%lld\n", exact[i].str,
+                   exact[i].val, val);
+            failures++;
+        }
+    }
+
+    qint64 checked = 0;
+    quint64 seed = 1;
+    for (int i = 0; i < 2000000; i++) {
+        qint64 n;
+        if (i < 200000) {
+            n = i - 100000;     // all small numbers including around zero
+        } else {
+            n = (qint64) (nextRandom(seed) >> 20) - (qint64) (1LL << 43);
+        }
+        QByteArray str = num2svg(n).toLatin1();
+        const char *p = str.constData();
+        qint64 val = 0;
+        if (!parseSvgNumber(p, p + str.size(), val) || val != n) {
+            if (failures < 10) {
+                printf("roundtrip %lld -> %s -> %lld\n", n, str.constData(),
+                       val);
+            }
+            failures++;
+        }
+        checked++;
+    }
+    printf("numbers roundtrip checked=%lld failures=%d\n", checked, failures);
+    return failures;
+}
+
+// Segments of svg path data d
+static void parsePath(const char *d, SegmentStore & segs)
+{
+    QByteArray svg = QByteArray("<path d=\"") + d + "\"/>";
+    StoreSink sink;
+    SvgReader reader(&sink);
+    reader.read(svg.constData(), svg.size());
+    segs = sink.segs;
+}
+
+// Distance of point from segment i
+static double segmentDistance(const SegmentStore & segs, int i, double x,
+                              double y)
+{
+    double ax = segs.x1[i];
+    double ay = segs.y1[i];
+    double dx = segs.x2[i] - ax;
+    double dy = segs.y2[i] - ay;
+    double len2 = dx * dx + dy * dy;
+    double t = (len2 > 0 ? ((x - ax) * dx + (y - ay) * dy) / len2 : 0);
+    t = (t < 0 ? 0 : (t > 1 ? 1 : t));
+    double ex = ax + t * dx - x;
+    double ey = ay + t * dy - y;
+    return sqrt(ex * ex + ey * ey);
+}
+
+// Segments are connected and go from x0, y0 exactly to x1, y1
+static bool isChain(const SegmentStore & segs, qint64 x0, qint64 y0,
+                    qint64 x1, qint64 y1)
+{
+    int n = segs.count();
+    if (n == 0 || segs.x1[0] != x0 || segs.y1[0] != y0 ||
+        segs.x2[n - 1] != x1 || segs.y2[n - 1] != y1) {
+        return false;
+    }
+    for (int i = 1; i < n; i++) {
+        if (segs.x1[i] != segs.x2[i - 1] || segs.y1[i] != segs.y2[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Flattening of cubic curves and arcs: flat curve is one chord, chords
+// stay within tolerance of the curve, arc hits its end point and compact
+// arc flags parse the same as separated ones. Returns number of failures.
+static int checkCurves()
+{
+    qint64 tolerance = SvgParseOptions().tolerance;
+    int failures = 0;
+    SegmentStore segs;
+
+    // Flat and almost flat curve
+    const char *flat[] = { "M0 0 C10 0 20 0 30 0",
+                           "M0 0 C10 0.01 20 -0.01 30 0" };
+    for (int i = 0; i < 2; i++) {
+        parsePath(flat[i], segs);
+        if (segs.count() != 1 || !isChain(segs, 0, 0, 30000, 0)) {
+            printf("curve %s segments=%d\n", flat[i], segs.count());
+            failures++;
+        }
+    }
+
+    // Every point of the curve is within tolerance of some chord
+    parsePath("M0 0 C0 100 100 100 100 0", segs);
+    double worst = 0;
+    for (int i = 0; i <= 1000; i++) {
+        double t = i / 1000.0;
+        double u = 1 - t;
+        double x = 3 * u * t * t * 100000 + t * t * t * 100000;
+        double y = 3 * u * u * t * 100000 + 3 * u * t * t * 100000;
+        double best = 1e18;
+        for (int j = 0; j < segs.count(); j++) {
+            double d = segmentDistance(segs, j, x, y);
+            best = (d < best ? d : best);
+        }
+        worst = (best > worst ? best : worst);
+    }
+    if (!isChain(segs, 0, 0, 100000, 0) || worst > tolerance) {
+        printf("cubic segments=%d worst_distance=%.1f\n", segs.count(),
+               worst);
+        failures++;
+    }
+    int cubicCount = segs.count();
+
+    // Half circle around 50,0 above the x axis (sweep 1), vertices on the
+    // circle, chord middles within tolerance and end exactly at 100,0
+    const char *arcs[] = { "M0 0 A50 50 0 0 1 100 0",
+                           "M0 0 A50 50 0 01100 0",
+                           "M0 0 A50,50,0,0,1,100,0",
+                           "M0 0 a50 50 0 0 1 100 0",
+                           "M0 0 A25 25 0 0 1 100 0" };
+    SegmentStore first;
+    for (int i = 0; i < 5; i++) {
+        parsePath(arcs[i], segs);
+        bool ok = isChain(segs, 0, 0, 100000, 0) && segs.count() == 36;
+        for (int j = 0; j < segs.count() && ok; j++) {
+            double r = sqrt((segs.x2[j] - 50000.0) * (segs.x2[j] - 50000.0) +
+                            (double) segs.y2[j] * segs.y2[j]);
+            double mx = (segs.x1[j] + segs.x2[j]) / 2.0 - 50000;
+            double my = (segs.y1[j] + segs.y2[j]) / 2.0;
+            double sag = 50000 - sqrt(mx * mx + my * my);
+            ok = (fabs(r - 50000) <= 1 && sag <= tolerance &&
+                  segs.y2[j] <= 0);
+        }
+        if (i == 0) {
+            first = segs;
+        } else {
+            ok = ok && segs.x1 == first.x1 && segs.y1 == first.y1 &&
+                segs.x2 == first.x2 && segs.y2 == first.y2;
+        }
+        if (!ok) {
+            printf("arc %s segments=%d\n", arcs[i], segs.count());
+            failures++;
+        }
+    }
+
+    // Flags 1 0 take the other half, compact or not
+    const char *below[] = { "M0 0 A50 50 0 1 0 100 0",
+                            "M0 0 A50 50 0 10100 0" };
+    for (int i = 0; i < 2; i++) {
+        parsePath(below[i], segs);
+        bool ok = isChain(segs, 0, 0, 100000, 0) &&
+            segs.count() == first.count();
+        for (int j = 0; j < segs.count() && ok; j++) {
+            ok = (segs.x2[j] == first.x2[j] && segs.y2[j] == -first.y2[j]);
+        }
+        if (!ok) {
+            printf("arc %s segments=%d\n", below[i], segs.count());
+            failures++;
+        }
+    }
+    printf("curves cubic_segments=%d cubic_distance=%.1f arc_segments=%d "
+           "failures=%d\n", cubicCount, worst, first.count(), failures);
+    return failures;
+}
+
+// PolylineSimplifier on segment lists with exactly known result. Returns
+// number of failures.
+static int checkSimplifier()
+{
+    struct {
+        const char *name;
+        qint64 tolerance;
+        int count;
+        qint64 in[4][4];
+        int outCount;
+        qint64 out[4][4];
+    } cases[] = {
+        { "collinear run", 0, 3,
+          { {0, 0, 1000, 0}, {1000, 0, 2000, 0}, {2000, 0, 5000, 0} },
+          1, { {0, 0, 5000, 0} } },
+        { "corner", 0, 2,
+          { {0, 0, 1000, 0}, {1000, 0, 1000, 1000} },
+          2, { {0, 0, 1000, 0}, {1000, 0, 1000, 1000} } },
+        { "zigzag exact", 0, 3,
+          { {0, 0, 1000, 20}, {1000, 20, 2000, -20}, {2000, -20, 3000, 0} },
+          3, { {0, 0, 1000, 20}, {1000, 20, 2000, -20},
+               {2000, -20, 3000, 0} } },
+        { "zigzag within tolerance", 50, 3,
+          { {0, 0, 1000, 20}, {1000, 20, 2000, -20}, {2000, -20, 3000, 0} },
+          1, { {0, 0, 3000, 0} } },
+        { "gap", 0, 2,
+          { {0, 0, 1000, 0}, {2000, 0, 3000, 0} },
+          2, { {0, 0, 1000, 0}, {2000, 0, 3000, 0} } },
+        { "turn back", 0, 3,
+          { {0, 0, 1000, 0}, {1000, 0, 2000, 0}, {2000, 0, 1000, 0} },
+          2, { {0, 0, 2000, 0}, {2000, 0, 1000, 0} } },
+    };
+    int failures = 0;
+    unsigned count = sizeof(cases) / sizeof(cases[0]);
+    for (unsigned i = 0; i < count; i++) {
+        StoreSink sink;
+        PolylineSimplifier simplifier(&sink, cases[i].tolerance);
+        for (int j = 0; j < cases[i].count; j++) {
+            const qint64 *s = cases[i].in[j];
+            simplifier.addSegment(s[0], s[1], s[2], s[3]);
+        }
+        simplifier.finish();
+        bool ok = (sink.segs.count() == cases[i].outCount);
+        for (int j = 0; j < sink.segs.count() && ok; j++) {
+            const qint64 *s = cases[i].out[j];
+            ok = (sink.segs.x1[j] == s[0] && sink.segs.y1[j] == s[1] &&
+                  sink.segs.x2[j] == s[2] && sink.segs.y2[j] == s[3]);
+        }
+        if (!ok) {
+            printf("simplify %s segments=%d\n", cases[i].name,
+                   sink.segs.count());
+            failures++;
+        }
+    }
+    printf("simplify checked=%u failures=%d\n", count, failures);
+    return failures;
+}
+
+// Offset of closed and open contours with every join. Checks number of
+// loops, that they are closed and their bounding box, which round joins
+// may miss by the tolerance. Returns number of failures.
+static int checkOffset()
+{
+    struct {
+        const char *name;
+        int points;
+        qint64 xs[6];
+        qint64 ys[6];
+        bool closed;
+        qint64 delta;
+        int loops;
+        qint64 box[4];          // min x, min y, max x, max y
+    } cases[] = {
+        { "square grow", 4, { 0, 10000, 10000, 0 }, { 0, 0, 10000, 10000 },
+          true, 1000, 1, { -1000, -1000, 11000, 11000 } },
+        { "square shrink", 4, { 0, 10000, 10000, 0 }, { 0, 0, 10000, 10000 },
+          true, -1000, 1, { 1000, 1000, 9000, 9000 } },
+        { "concave L grow", 6, { 0, 20000, 20000, 10000, 10000, 0 },
+          { 0, 0, 10000, 10000, 20000, 20000 },
+          true, 1000, 1, { -1000, -1000, 21000, 21000 } },
+        { "concave L shrink", 6, { 0, 20000, 20000, 10000, 10000, 0 },
+          { 0, 0, 10000, 10000, 20000, 20000 },
+          true, -1000, 1, { 1000, 1000, 19000, 19000 } },
+        { "vanishing", 4, { 0, 2000, 2000, 0 }, { 0, 0, 2000, 2000 },
+          true, -1500, 0, { 0, 0, 0, 0 } },
+        { "open path", 3, { 0, 10000, 10000 }, { 0, 0, 5000 },
+          false, 1000, 1, { -1000, -1000, 11000, 6000 } },
+        { "open path negative", 3, { 0, 10000, 10000 }, { 0, 0, 5000 },
+          false, -1000, 1, { -1000, -1000, 11000, 6000 } },
+    };
+    int failures = 0;
+    int checked = 0;
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        SegmentStore segs;
+        int n = cases[i].points;
+        for (int j = 0; j < (cases[i].closed ? n : n - 1); j++) {
+            segs.append(cases[i].xs[j], cases[i].ys[j],
+                        cases[i].xs[(j + 1) % n], cases[i].ys[(j + 1) % n]);
+        }
+        for (int join = OffsetJoinMiter; join <= OffsetJoinSquare; join++) {
+            OffsetOptions options;
+            options.join = (OffsetJoin) join;
+            SegmentStore path;
+            int loops = offsetSegments(segs, cases[i].delta, options, path);
+
+            QVector<Contour> contours;
+            buildContours(path, contours);
+            int closed = 0;
+            for (int j = 0; j < contours.count(); j++) {
+                closed += (contours[j].closed ? 1 : 0);
+            }
+            SegmentBounds box;
+            for (int j = 0; j < path.count(); j++) {
+                box.add(path.x1[j], path.y1[j]);
+                box.add(path.x2[j], path.y2[j]);
+            }
+            qint64 err = (join == OffsetJoinRound ? options.tolerance : 0);
+            bool ok = (loops == cases[i].loops && closed == loops &&
+                       contours.count() == loops);
+            if (ok && loops > 0) {
+                qint64 got[4] = { box.minX, box.minY, box.maxX, box.maxY };
+                for (int j = 0; j < 4; j++) {
+                    qint64 diff = got[j] - cases[i].box[j];
+                    ok = ok && (diff <= err && diff >= -err);
+                }
+            }
+            if (!ok) {
+                printf("offset %s join=%d loops=%d closed=%d box=%lld,%lld,"
+                       "%lld,%lld\n", cases[i].name, join, loops, closed,
+                       box.minX, box.minY, box.maxX, box.maxY);
+                failures++;
+            }
+            checked++;
+        }
+    }
+    printf("offset checked=%d failures=%d\n", checked, failures);
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // -order runs just the ordering suite, -only<name> picks its inputs
+    QStringList files;
+    int iterations = 1000;
+    bool order = false;
+    QString only;
+    int budgetMs = 1000;
+    for (int i = 1; i < argc; i++) {
+        QString arg = argv[i];
+        if (arg.startsWith("-n")) {
+            iterations = arg.mid(2).toInt();
+        } else if (arg == "-order") {
+            order = true;
+        } else if (arg.startsWith("-only")) {
+            only = arg.mid(5);
+        } else if (arg.startsWith("-budget")) {
+            budgetMs = arg.mid(7).toInt();
+        } else {
+            files.append(arg);
+        }
+    }
+    if (order) {
+        if (files.isEmpty()) {
+            QDir dir(SRCDIR "/..");
+            QStringList names = dir.entryList(QStringList("*.svg"),
+                                              QDir::Files, QDir::Name);
+            for (int i = 0; i < names.count(); i++) {
+                files.append(dir.filePath(names.at(i)));
+            }
+        }
+        return (orderBench(files, only, budgetMs) ? 1 : 0);
+    }
+    if (files.isEmpty()) {
+        files.append(SRCDIR "/../pcb_milling.svg");
+        files.append(SRCDIR "/../case.svg");
+    }
+
+    int failures = checkNumbers();
+    failures += checkCurves();
+    failures += checkSimplifier();
+    failures += checkOffset();
+    failures += checkMachineCost();
+    benchNumbers(iterations / 10 + 1);
+    failures += benchTransform(4000000, 10);
+    failures += benchWriter(1000000);
+    failures += benchOrder(50000, true);
+    failures += benchOrder(1000000, false);
+    failures += benchSmallLayer();
+    failures += benchJob();
+    for (int i = 0; i < files.count(); i++) {
+        benchSvg(files.at(i), iterations);
+    }
+    return (failures ? 1 : 0);
+}
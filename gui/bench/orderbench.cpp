@@ -0,0 +1,242 @@
+#include "orderbench.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+
+#include <math.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "machinecost.h"
+#include "optimizer.h"
+#include "planner.h"
+#include "polyline.h"
+#include "random.h"
+#include "segmentstore.h"
+#include "svgreader.h"
+
+// Segments read from svg, same as loadSvg() in mainwindow.cpp without the
+// cache
+class LayerSink : public SvgSegmentSink
+{
+public:
+    SegmentStore & segs;
+
+    LayerSink(SegmentStore & segs)
+    :  segs(segs)
+    {
+    }
+
+    bool addSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2)
+    {
+        return segs.append(x1, y1, x2, y2);
+    }
+};
+
+static bool loadLayer(const QString & path, SegmentStore & segs)
+{
+    SvgParseOptions options;
+    LayerSink sink(segs);
+    PolylineSimplifier simplifier(&sink, options.simplifyTolerance);
+    SvgReader reader(&simplifier, options);
+    bool ok = reader.readFile(path);
+    simplifier.finish();
+    return ok;
+}
+
+// Unrelated segments up to 5 px long on 300x200 px
+static void randomLayer(int count, SegmentStore & segs)
+{
+    quint64 seed = 1;
+    segs.reserve(count);
+    for (int i = 0; i < count; i++) {
+        qint64 x = (nextRandom(seed) >> 16) % 300000;
+        qint64 y = (nextRandom(seed) >> 16) % 200000;
+        qint64 dx = (qint64) ((nextRandom(seed) >> 16) % 10001) - 5000;
+        qint64 dy = (qint64) ((nextRandom(seed) >> 16) % 10001) - 5000;
+        segs.append(x, y, x + dx, y + dy);
+    }
+}
+
+// All edges of a square grid, every point joins four segments and many
+// end points are equally near
+static void gridLayer(int count, SegmentStore & segs)
+{
+    int k = 1;
+    while (2 * k * (k + 1) < count) {
+        k++;
+    }
+    qint64 d = 1000;
+    segs.reserve(2 * k * (k + 1));
+    for (int i = 0; i <= k && segs.count() < count; i++) {
+        for (int j = 0; j < k && segs.count() < count; j++) {
+            segs.append(j * d, i * d, (j + 1) * d, i * d);
+            if (segs.count() < count) {
+                segs.append(i * d, j * d, i * d, (j + 1) * d);
+            }
+        }
+    }
+}
+
+// Traces of horizontal, vertical and diagonal runs between octagon pads,
+// packed on a small board like pcb_milling.svg
+static void pcbLayer(int count, SegmentStore & segs)
+{
+    static const int dirs[8][2] = {
+        { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 },
+        { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 },
+    };
+    quint64 seed = 2;
+    qint64 size = (qint64) sqrt((double) count) * 2000 + 20000;
+    segs.reserve(count + 32);
+    while (segs.count() < count) {
+        qint64 x = (nextRandom(seed) >> 16) % size;
+        qint64 y = (nextRandom(seed) >> 16) % size;
+        int runs = 2 + (nextRandom(seed) >> 16) % 6;
+        int dir = (nextRandom(seed) >> 16) % 8;
+        for (int pad = 0; pad < 2; pad++) {
+            if (pad == 1) {
+                for (int r = 0; r < runs; r++) {
+                    dir = (dir + (int) ((nextRandom(seed) >> 16) % 3) + 7) % 8;
+                    qint64 len = 500 + (nextRandom(seed) >> 16) % 4000;
+                    qint64 nx = x + dirs[dir][0] * len;
+                    qint64 ny = y + dirs[dir][1] * len;
+                    segs.append(x, y, nx, ny);
+                    x = nx;
+                    y = ny;
+                }
+            }
+
+            // Octagon pad around the trace end
+            qint64 r = 600;
+            qint64 px = x + r;
+            qint64 py = y;
+            for (int i = 1; i <= 8; i++) {
+                double a = i * M_PI / 4;
+                qint64 nx = x + (qint64) (r * cos(a));
+                qint64 ny = y + (qint64) (r * sin(a));
+                segs.append(px, py, nx, ny);
+                px = nx;
+                py = ny;
+            }
+        }
+    }
+}
+
+static qint64 maxRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static double cutDistance(const SegmentStore & segs)
+{
+    double res = 0;
+    for (int i = 0; i < segs.count(); i++) {
+        double w = segs.x2[i] - segs.x1[i];
+        double h = segs.y2[i] - segs.y1[i];
+        res += sqrt(w * w + h * h);
+    }
+    return res;
+}
+
+// Svg file name or generator name, no quotes or backslashes
+static QString jsonName(const QString & name)
+{
+    QString res = name;
+    res.replace('\\', '/');
+    res.replace('"', '\'');
+    return res;
+}
+
+// Plan layer the way millShape() does and print its line. Returns number
+// of failures.
+static int orderLayer(const QString & name, const SegmentStore & segs,
+                      int budgetMs)
+{
+    qint64 x = (segs.isEmpty() ? 0 : segs.x1[0]);
+    qint64 y = (segs.isEmpty() ? 0 : segs.y1[0]);
+    MachineCost machine;
+
+    QElapsedTimer timer;
+    timer.start();
+    LayerPlanner planner(segs);
+    LayerPlan plan;
+    planner.plan(x, y, true, plan);
+    qint64 planNs = timer.nsecsElapsed();
+
+    double greedyDist = ChainOptimizer::rapidDistance(segs, plan, x, y);
+    int greedyRapids = plan.rapids;
+
+    timer.restart();
+    ChainOptimizer optimizer(segs, machine);
+    optimizer.optimize(x, y, true, budgetMs, plan);
+    qint64 optNs = timer.nsecsElapsed();
+
+    double dist = ChainOptimizer::rapidDistance(segs, plan, x, y);
+    double cutTime = machine.planTime(segs, plan);
+
+    QVector<int> cut(segs.count(), 0);
+    for (int i = 0; i < plan.steps.count(); i++) {
+        cut[LayerPlan::segment(plan.steps[i])]++;
+    }
+    int failures = (plan.steps.count() != segs.count() ? 1 : 0);
+    for (int i = 0; i < segs.count(); i++) {
+        failures += (cut[i] != 1 ? 1 : 0);
+    }
+
+    printf("{\"input\":\"%s\",\"segments\":%d,\"chains\":%d,"
+           "\"plan_ms\":%.2f,\"optimize_ms\":%.2f,\"maxrss_kb\":%lld,"
+           "\"rapids_greedy\":%d,\"rapids\":%d,"
+           "\"rapid_distance_greedy\":%.0f,\"rapid_distance\":%.0f,"
+           "\"rapid_time_s_greedy\":%.1f,\"rapid_time_s\":%.1f,"
+           "\"cut_distance\":%.0f,\"cut_time_s\":%.1f,\"failures\":%d}\n",
+           qPrintable(jsonName(name)), segs.count(),
+           plan.chainStarts.count(), planNs / 1e6, optNs / 1e6, maxRssKb(),
+           greedyRapids, plan.rapids, greedyDist, dist,
+           optimizer.before() / 1e6, optimizer.after() / 1e6,
+           cutDistance(segs), cutTime / 1e6, failures);
+    fflush(stdout);
+    return failures;
+}
+
+int orderBench(const QStringList & files, const QString & only, int budgetMs)
+{
+    int failures = 0;
+    for (int i = 0; i < files.count(); i++) {
+        QString name = QFileInfo(files.at(i)).fileName();
+        if (!name.contains(only)) {
+            continue;
+        }
+        SegmentStore segs;
+        if (!loadLayer(files.at(i), segs)) {
+            printf("{\"input\":\"%s\",\"error\":\"load failed\"}\n",
+                   qPrintable(jsonName(name)));
+            failures++;
+            continue;
+        }
+        failures += orderLayer(name, segs, budgetMs);
+    }
+
+    static const int sizes[] = { 10000, 100000, 1000000 };
+    for (int i = 0; i < 3; i++) {
+        for (int kind = 0; kind < 3; kind++) {
+            static const char *kinds[] = { "random", "grid", "pcb" };
+            QString name = QString("%1-%2").arg(kinds[kind]).arg(sizes[i]);
+            if (!name.contains(only)) {
+                continue;
+            }
+            SegmentStore segs;
+            if (kind == 0) {
+                randomLayer(sizes[i], segs);
+            } else if (kind == 1) {
+                gridLayer(sizes[i], segs);
+            } else {
+                pcbLayer(sizes[i], segs);
+            }
+            failures += orderLayer(name, segs, budgetMs);
+        }
+    }
+    return failures;
+}
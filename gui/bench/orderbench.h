@@ -0,0 +1,17 @@
+#ifndef ORDERBENCH_H
+#define ORDERBENCH_H
+
+#include <QString>
+#include <QStringList>
+
+// Ordering stage of millShape() (LayerPlanner + ChainOptimizer) on svg
+// files and generated layers, one JSON object per line and input.
+//
+// Generated inputs are random segments, grid of connected edges and dense
+// pcb traces with pads at 10k, 100k and 1M segments. If only is not empty
+// just inputs whose name contains it are run. maxrss_kb is peak of the
+// whole process so far, run one input per process for exact numbers.
+// Returns number of failures (plan not cutting every segment once).
+int orderBench(const QStringList & files, const QString & only, int budgetMs);
+
+#endif // ORDERBENCH_H
@@ -0,0 +1,15 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <QtGlobal>
+
+// Linear congruential generator of the generated inputs, same seed gives
+// the same inputs on every run. Returns the new state, low bits are poor,
+// use the high ones.
+inline quint64 nextRandom(quint64 & seed)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed;
+}
+
+#endif // RANDOM_H
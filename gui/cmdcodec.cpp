@@ -0,0 +1,121 @@
+#include "cmdcodec.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+CmdEncoder::CmdEncoder()
+:  ver(0)
+{
+    last[0] = last[1] = last[2] = 0;
+}
+
+bool CmdEncoder::isNegotiated() const
+{
+    return ver > 0;
+}
+
+int CmdEncoder::version() const
+{
+    return ver;
+}
+
+int CmdEncoder::negotiate(CmdLink & link)
+{
+    last[0] = last[1] = last[2] = 0;
+    ver = 1;
+    int errors = link.errors();
+    if (!link.write("V" + QString::number(PROTO_VERSION).toAscii() + " ")) {
+        return ver;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < PROTO_TIMEOUT_MS) {
+        if (link.version() >= 0) {
+            ver = qBound(1, link.version(), PROTO_VERSION);
+            break;
+        }
+        if (link.errors() > errors) {
+            break;              // arduino does not know V
+        }
+        link.read(10);
+    }
+    qDebug() << "protocol version" << ver;
+    return ver;
+}
+
+void CmdEncoder::appendVarint(QByteArray & out, qint32 val)
+{
+    quint32 v = ((quint32) val << 1) ^ (quint32) (val >> 31);
+    while (v >= 0x80) {
+        out.append((char) ((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.append((char) v);
+}
+
+void CmdEncoder::appendMove(QByteArray & out, int bits, const qint32 *delta)
+{
+    out.append((char) (OP_MOVE | bits));
+    for (int axis = 0; axis < 3; axis++) {
+        if (bits & (1 << axis)) {
+            appendVarint(out, delta[axis]);
+        }
+    }
+}
+
+QByteArray CmdEncoder::encode(const QByteArray & cmds)
+{
+    QByteArray res;
+    int bits = 0;               // axes of binary move being collected
+    qint32 delta[3];
+    int pos = 0;
+    while (pos < cmds.count()) {
+        int end = cmds.indexOf(' ', pos);
+        if (end < 0) {
+            end = cmds.count();
+        }
+        QByteArray token = cmds.mid(pos, end - pos);
+        pos = end + 1;
+        if (token.isEmpty()) {
+            continue;
+        }
+
+        char cmd = token.at(0);
+        int axis = cmd - 'x';
+        bool ok = false;
+        qint32 arg = token.mid(1).toInt(&ok);
+        if (axis >= 0 && axis < 3 && (bits & (1 << axis))) {
+            appendMove(res, bits, delta);       // same axis again
+            bits = 0;
+        }
+        if (ver >= 2 && axis >= 0 && axis < 3 && ok) {
+            delta[axis] = arg - last[axis];
+            last[axis] = arg;
+            bits |= 1 << axis;
+            continue;
+        }
+        if (ver >= 2 && cmd == 'm' && token.count() == 1) {
+            appendMove(res, bits | 8, delta);
+            bits = 0;
+            continue;
+        }
+        if (bits) {
+            appendMove(res, bits, delta);
+            bits = 0;
+        }
+
+        // Arduino keeps arguments of ASCII commands as well
+        if (axis >= 0 && axis < 3) {
+            last[axis] = arg;
+        } else if (cmd == 'V') {
+            last[0] = last[1] = last[2] = 0;
+        }
+        res.append(token);
+        res.append(' ');
+    }
+    if (bits) {
+        appendMove(res, bits, delta);
+    }
+    return res;
+}
@@ -0,0 +1,49 @@
+#ifndef CMDCODEC_H
+#define CMDCODEC_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "cmdlink.h"
+
+// Protocol versions: 1=ASCII commands, 2=also binary moves. Must match
+// arduino.
+#define PROTO_VERSION 2
+#define OP_MOVE 0x80
+
+// Wait for version report
+#define PROTO_TIMEOUT_MS 1000
+
+// Turns ASCII commands to what arduino understands.
+//
+// With version 2 runs of x, y, z commands, optionally ending with m, are
+// sent as one binary move: OP_MOVE + axis bits (1=x, 2=y, 4=z, 8=m) and
+// for each axis difference from its previous argument as zigzag varint.
+// Small moves take 2-4 bytes instead of ~13 of "x1234 y567 m ". Other
+// commands (also a, p, t moves and m with argument) stay ASCII, previous
+// arguments are tracked for them too.
+class CmdEncoder
+{
+public:
+    CmdEncoder();
+
+    // Version is not known until negotiate()
+    bool isNegotiated() const;
+    int version() const;
+
+    // Send V command, use the version arduino reports or ASCII if it does
+    // not know V. Returns version.
+    int negotiate(CmdLink & link);
+
+    QByteArray encode(const QByteArray & cmds);
+
+    static void appendVarint(QByteArray & out, qint32 val);
+
+private:
+    int ver;                    // 0 until negotiated
+    qint32 last[3];             // previous x, y, z argument on arduino
+
+    void appendMove(QByteArray & out, int bits, const qint32 *delta);
+};
+
+#endif // CMDCODEC_H
@@ -0,0 +1,253 @@
+#include "cmdlink.h"
+
+#include <QDebug>
+
+CmdLink::CmdLink(QIODevice & port, QAtomicInt *stop)
+:  port(port), stop(stop), wordLen(0), number(-1), number2(-1),
+   inNumber(false), lastQueueDone(0), lastMoveDone(0), lastVersion(-1), errorCount(0),
+   limit(false), logPos(0), logFull(false), seq(0), base(0), sent(0),
+   credit(-1), retries(0)
+{
+}
+
+int CmdLink::queueDone() const
+{
+    return lastQueueDone;
+}
+
+int CmdLink::moveDone() const
+{
+    return lastMoveDone;
+}
+
+int CmdLink::version() const
+{
+    return lastVersion;
+}
+
+int CmdLink::errors() const
+{
+    return errorCount;
+}
+
+bool CmdLink::limitReached() const
+{
+    return limit;
+}
+
+void CmdLink::clearLimit()
+{
+    limit = false;
+}
+
+QString CmdLink::recentLog() const
+{
+    QString res;
+    if (logFull) {
+        res = QString::fromAscii(logRing + logPos, REPORT_LOG_LEN - logPos);
+    }
+    return res + QString::fromAscii(logRing, logPos);
+}
+
+quint16 CmdLink::crc16(quint16 crc, quint8 b)
+{
+    // CRC-16/CCITT, polynomial 0x1021
+    crc ^= (quint16) b << 8;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+QList<QByteArray> CmdLink::frames(const QByteArray & cmds, quint8 & seq)
+{
+    QList<QByteArray> res;
+    for (int i = 0; i < cmds.count(); i += FRAME_PAYLOAD) {
+        QByteArray payload = cmds.mid(i, FRAME_PAYLOAD);
+        QByteArray frame;
+        frame.append((char) FRAME_START);
+        frame.append((char) seq);
+        frame.append((char) payload.count());
+        frame.append(payload);
+
+        quint16 crc = 0xffff;
+        for (int j = 1; j < frame.count(); j++) {
+            crc = crc16(crc, frame.at(j));
+        }
+        frame.append((char) (crc >> 8));
+        frame.append((char) (crc & 0xff));
+        res.append(frame);
+        seq++;
+    }
+    return res;
+}
+
+// Next frame can be sent: fits in the space arduino reported and in its
+// serial buffer
+bool CmdLink::fits() const
+{
+    if (sent >= FRAME_WINDOW) {
+        return false;
+    }
+    if (credit < 0) {
+        return true;
+    }
+    int bytes = 0;
+    for (int i = 0; i <= sent; i++) {
+        bytes += (quint8) unacked.at(i).at(2);
+    }
+    return bytes <= credit;
+}
+
+bool CmdLink::write(const QByteArray & cmds)
+{
+    base = seq;
+    unacked = frames(cmds, seq);
+    sent = 0;
+    retries = 0;
+    ackTimer.start();
+    while (!unacked.isEmpty()) {
+        while (sent < unacked.count() && fits()) {
+            port.write(unacked.at(sent));
+            sent++;
+        }
+        read(5);
+        if (stop && stop->fetchAndAddAcquire(0)) {
+            unacked.clear();
+            return false;
+        }
+        if (ackTimer.elapsed() < FRAME_TIMEOUT_MS) {
+            continue;
+        }
+        if (++retries > FRAME_RETRIES) {
+            qDebug() << "arduino does not ack frame" << base;
+            unacked.clear();
+            return false;
+        }
+        qDebug() << "no ack for frame" << base << ", sending again";
+        sent = 0;
+        if (!fits()) {
+            port.write(unacked.first());        // ask for free space again
+            sent = 1;
+        }
+        ackTimer.start();
+    }
+    return true;
+}
+
+QByteArray CmdLink::read(int msecs)
+{
+    if (port.bytesAvailable() <= 0) {
+        port.waitForReadyRead(msecs);
+    }
+    QByteArray data = port.read(1024);
+    for (int i = 0; i < data.count(); i++) {
+        char ch = data.at(i);
+        if (ch == '\n') {
+            if (wordLen > 0 || number >= 0) {
+                report();
+            }
+            wordLen = 0;
+            number = number2 = -1;
+            inNumber = false;
+        } else if (ch >= '0' && ch <= '9') {
+            if (!inNumber && number2 < 0) {
+                if (number < 0) {
+                    number = 0;
+                } else {
+                    number2 = 0;
+                }
+                inNumber = true;
+            }
+            int & n = (number2 >= 0 ? number2 : number);
+            if (inNumber && n < 100000000) {
+                n = n * 10 + ch - '0';
+            }
+        } else if ((ch >= 'a' && ch <= 'z') ||
+                   (ch >= 'A' && ch <= 'Z') || ch == ' ') {
+            inNumber = false;
+            // word is before numbers
+            if (wordLen < REPORT_WORD && number < 0) {
+                word[wordLen++] = ch;
+            }
+        }
+    }
+    return data;
+}
+
+bool CmdLink::isWord(const char *name, bool prefix) const
+{
+    int i = 0;
+    for (; name[i]; i++) {
+        if (i >= wordLen || word[i] != name[i]) {
+            return false;
+        }
+    }
+    return prefix || i == wordLen;
+}
+
+void CmdLink::logReport()
+{
+    QByteArray text = QByteArray(word, wordLen);
+    if (number >= 0) {
+        text.append(QByteArray::number(number));
+    }
+    if (number2 >= 0) {
+        text.append(' ');
+        text.append(QByteArray::number(number2));
+    }
+    text.append('\n');
+    for (int i = 0; i < text.count(); i++) {
+        logRing[logPos++] = text.at(i);
+        if (logPos == REPORT_LOG_LEN) {
+            logPos = 0;
+            logFull = true;
+        }
+    }
+}
+
+void CmdLink::report()
+{
+    bool ack = isWord("ack", false);
+    bool nak = isWord("nak", false);
+    if (!ack && !nak) {
+        logReport();
+        if (isWord("qdone", false) && number >= 0) {
+            lastQueueDone = number;
+        } else if (isWord("done", false) && number >= 0) {
+            lastMoveDone = number;
+        } else if (isWord("version", false) && number >= 0) {
+            lastVersion = number;
+        } else if (isWord("error", true)) {
+            errorCount++;
+            qDebug() << "arduino:" << QByteArray(word, wordLen) << number;
+        } else if (isWord("limit", true)) {
+            limit = true;
+        }
+        return;
+    }
+
+    // Frames before the one reported are stored by arduino
+    if (number < 0) {
+        return;
+    }
+    if (number2 >= 0) {
+        credit = number2;       // also in acks of old frames
+    }
+    quint8 s = number;
+    int n = (quint8) (s - base) + (ack ? 1 : 0);
+    if (n > sent) {
+        return;                 // old or duplicate
+    }
+    for (int i = 0; i < n; i++) {
+        unacked.removeFirst();
+    }
+    base += n;
+    sent -= n;
+    if (nak) {
+        qDebug() << "frame" << s << "corrupt or no space, sending again";
+        sent = 0;
+    }
+    retries = 0;
+    ackTimer.start();
+}
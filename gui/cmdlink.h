@@ -0,0 +1,104 @@
+#ifndef CMDLINK_H
+#define CMDLINK_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+
+// Frame: start byte, sequence number, payload length, payload, CRC16 of
+// sequence, length and payload (high byte first). Must match arduino.
+#define FRAME_START 1
+#define FRAME_PAYLOAD 16
+
+// Frames sent before waiting for ack, 3 frames of 21 bytes fit in 64 byte
+// serial buffer of arduino even if it can not read them for a while
+#define FRAME_WINDOW 3
+
+// No ack for this long resends frames, after FRAME_RETRIES we give up
+#define FRAME_TIMEOUT_MS 1000
+#define FRAME_RETRIES 10
+
+// Longer report words are cut, reports are kept in a ring of REPORT_LOG_LEN
+#define REPORT_WORD 24
+#define REPORT_LOG_LEN 1024
+
+// Commands for arduino sent in checksummed frames.
+//
+// Arduino sends "ack<seq> <free>" for every frame it stored (and for all
+// before it) and "nak<seq> <free>" for a corrupt one or one it had no
+// space for, seq being the frame it expects. Frames from the nak'ed or
+// timed out one are sent again. Free is space in arduino receive buffer,
+// frames are sent only while their payloads fit in it, so its command
+// queue is kept as full as it can be without losing frames.
+//
+// Arduino sends its reports between new lines as words and a number.
+// They are parsed as bytes come, only the last qdone, done and version
+// numbers are kept, so waiting for a queue does not search a growing log.
+// Reports other then acks are also kept in a ring for showing them.
+class CmdLink
+{
+public:
+    // write() gives up when stop is set
+    CmdLink(QIODevice & port, QAtomicInt *stop = 0);
+
+    // Send commands, returns after all frames are acked or false if
+    // arduino did not ack them after FRAME_RETRIES timeouts or stop was set
+    bool write(const QByteArray & cmds);
+
+    // Wait up to msecs for data, handle acks and reports. Returns data read.
+    QByteArray read(int msecs);
+
+    // Split commands to frames starting with sequence number seq
+    static QList<QByteArray> frames(const QByteArray & cmds, quint8 & seq);
+
+    static quint16 crc16(quint16 crc, quint8 b);
+
+    // Last reported numbers, 0 if not reported yet (version -1)
+    int queueDone() const;
+    int moveDone() const;
+    int version() const;
+
+    // Errors reported so far
+    int errors() const;
+
+    // Limit switch reported, stays set until clearLimit()
+    bool limitReached() const;
+    void clearLimit();
+
+    // Last REPORT_LOG_LEN characters of reports, one per line
+    QString recentLog() const;
+
+private:
+    QIODevice & port;
+    QAtomicInt *stop;
+    char word[REPORT_WORD];     // report being read, letters and spaces
+    int wordLen;
+    int number;                 // its first number, -1 if none yet
+    int number2;                // and second one
+    bool inNumber;
+    int lastQueueDone;
+    int lastMoveDone;
+    int lastVersion;
+    int errorCount;
+    bool limit;
+    char logRing[REPORT_LOG_LEN];
+    int logPos;                 // next character of logRing to write
+    bool logFull;               // logRing wrapped
+    quint8 seq;                 // sequence number of next frame
+    QList<QByteArray> unacked;  // sent or to be sent, first has seq base
+    quint8 base;
+    int sent;                   // frames of unacked written to port
+    int credit;                 // free bytes reported by arduino, -1 unknown
+    int retries;
+    QElapsedTimer ackTimer;     // since last ack or resend
+
+    bool fits() const;
+    void report();
+    bool isWord(const char *name, bool prefix) const;
+    void logReport();
+};
+
+#endif // CMDLINK_H
@@ -0,0 +1,140 @@
+#include "geomcache.h"
+
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GEOM_CACHE_MAGIC "ALFIGEO1"
+
+// Cache file header, followed by x1, y1, x2 and y2 arrays of qint32
+struct GeomCacheHeader
+{
+    char magic[8];
+    char key[20];               // sha1 of content + options
+    qint32 count;
+    qint64 minX;
+    qint64 maxX;
+    qint64 minY;
+    qint64 maxY;
+};
+
+GeomCache::GeomCache(const QString & dir)
+:  dir(dir)
+{
+    if (this->dir.isEmpty()) {
+        this->dir = QDir::homePath() + "/.cache/alfi";
+    }
+}
+
+QByteArray GeomCache::key(const char *content, qint64 len,
+                          const QByteArray & options)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(content, len);
+    hash.addData(options);
+    return hash.result();
+}
+
+QString GeomCache::entryPath(const QByteArray & key) const
+{
+    return dir + "/" + QString(key.toHex()) + ".geo";
+}
+
+bool GeomCache::load(const QByteArray & key, SegmentStore & segs,
+                     SegmentBounds & bounds)
+{
+    QFile f(entryPath(key));
+    if (!f.open(QFile::ReadOnly)) {
+        return false;           // not cached yet
+    }
+
+    qint64 size = f.size();
+    if (size < (qint64) sizeof(GeomCacheHeader)) {
+        return false;
+    }
+    const uchar *data = f.map(0, size);
+    if (!data) {
+        return false;
+    }
+
+    GeomCacheHeader hdr;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (memcmp(hdr.magic, GEOM_CACHE_MAGIC, 8) != 0 ||
+        memcmp(hdr.key, key.constData(), 20) != 0 || hdr.count < 0 ||
+        size != (qint64) sizeof(hdr) + 16 * (qint64) hdr.count) {
+        qWarning() << "invalid geometry cache entry " << f.fileName();
+        return false;
+    }
+
+    int count = hdr.count;
+    const uchar *arrays = data + sizeof(hdr);
+    segs.clear();
+    segs.x1.resize(count);
+    segs.y1.resize(count);
+    segs.x2.resize(count);
+    segs.y2.resize(count);
+    memcpy(segs.x1.data(), arrays, 4 * count);
+    memcpy(segs.y1.data(), arrays + 4 * count, 4 * count);
+    memcpy(segs.x2.data(), arrays + 8 * count, 4 * count);
+    memcpy(segs.y2.data(), arrays + 12 * count, 4 * count);
+
+    bounds.minX = hdr.minX;
+    bounds.maxX = hdr.maxX;
+    bounds.minY = hdr.minY;
+    bounds.maxY = hdr.maxY;
+    return true;
+}
+
+bool GeomCache::save(const QByteArray & key, const SegmentStore & segs,
+                     const SegmentBounds & bounds)
+{
+    if (!QDir().mkpath(dir)) {
+        qWarning() << "failed to create geometry cache dir " << dir;
+        return false;
+    }
+
+    GeomCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GEOM_CACHE_MAGIC, 8);
+    memcpy(hdr.key, key.constData(), 20);
+    hdr.count = segs.count();
+    hdr.minX = bounds.minX;
+    hdr.maxX = bounds.maxX;
+    hdr.minY = bounds.minY;
+    hdr.maxY = bounds.maxY;
+
+    QString path = entryPath(key);
+    // Layers are loaded in parallel, temp name must be unique per call
+    static QAtomicInt tmpCounter;
+    QString tmpPath = path + ".tmp" + QString::number(getpid()) + "." +
+        QString::number(tmpCounter.fetchAndAddOrdered(1));
+    QFile f(tmpPath);
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "failed to write " << tmpPath << ": " << f.errorString();
+        return false;
+    }
+
+    qint64 len = 4 * (qint64) hdr.count;
+    bool ok = f.write((const char *) &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        f.write((const char *) segs.x1.constData(), len) == len &&
+        f.write((const char *) segs.y1.constData(), len) == len &&
+        f.write((const char *) segs.x2.constData(), len) == len &&
+        f.write((const char *) segs.y2.constData(), len) == len &&
+        f.flush() && fsync(f.handle()) == 0;
+    f.close();
+
+    // rename() replaces existing entry atomically
+    if (!ok || rename(QFile::encodeName(tmpPath).constData(),
+                      QFile::encodeName(path).constData()) != 0) {
+        qWarning() << "failed to write geometry cache entry " << path;
+        QFile::remove(tmpPath);
+        return false;
+    }
+    return true;
+}
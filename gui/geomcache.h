@@ -0,0 +1,34 @@
+#ifndef GEOMCACHE_H
+#define GEOMCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "segmentstore.h"
+
+// On-disk cache of parsed svg layers.
+//
+// Entry is keyed by sha1 of svg file content plus parse options and holds
+// segment arrays and bounds of the layer. Entries are memory mapped on load
+// and written atomically (temp file renamed over the entry), so a crash
+// never leaves half written entry behind.
+class GeomCache
+{
+public:
+    GeomCache(const QString & dir = QString());
+
+    static QByteArray key(const char *content, qint64 len,
+                          const QByteArray & options);
+
+    bool load(const QByteArray & key, SegmentStore & segs,
+              SegmentBounds & bounds);
+    bool save(const QByteArray & key, const SegmentStore & segs,
+              const SegmentBounds & bounds);
+
+    QString entryPath(const QByteArray & key) const;
+
+private:
+    QString dir;
+};
+
+#endif // GEOMCACHE_H
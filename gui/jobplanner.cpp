@@ -0,0 +1,317 @@
+#include "jobplanner.h"
+
+JobPlanner::JobPlanner(const MachineCost & machine)
+:  machine(machine), minLevel(0), maxLevel(0), bestCost(0), orderCost(0),
+   bestZLevels(0)
+{
+}
+
+int JobPlanner::addOperation(int layer, const SegmentStore & segs,
+                             const LayerPlan & plan, int firstLevel,
+                             int lastLevel)
+{
+    Operation op;
+    op.layer = layer;
+    op.firstLevel = firstLevel;
+    op.lastLevel = lastLevel;
+    op.after = -1;
+    op.outline = false;
+    ops.append(op);
+
+    if (layers.count() <= layer) {
+        LayerEnds none;
+        none.sx = none.sy = none.ex = none.ey = 0;
+        none.empty = true;
+        none.cutTime = 0;
+        while (layers.count() <= layer) {
+            layers.append(none);
+        }
+    }
+    LayerEnds & e = layers[layer];
+    e.empty = !plan.ends(segs, e.sx, e.sy, e.ex, e.ey);
+    e.cutTime = machine.planTime(segs, plan);
+    return ops.count() - 1;
+}
+
+void JobPlanner::setAfter(int op, int other)
+{
+    ops[op].after = other;
+}
+
+void JobPlanner::setOutline(int op)
+{
+    ops[op].outline = true;
+}
+
+double JobPlanner::cost() const
+{
+    return bestCost;
+}
+
+double JobPlanner::givenOrderCost() const
+{
+    return orderCost;
+}
+
+int JobPlanner::zLevels() const
+{
+    return bestZLevels;
+}
+
+// Move tool of state s to Z level
+void JobPlanner::moveZ(State & s, int level) const
+{
+    int dz = level - s.level;
+    s.cost += machine.levelTime(dz);
+    s.zLevels += (dz < 0 ? -dz : dz);
+    s.level = level;
+}
+
+// Mill levels of piece from the next level of its operation in state s,
+// append its passes to steps if not NULL
+void JobPlanner::run(const Piece & piece, State & s,
+                     QVector<JobStep> *steps) const
+{
+    const Operation & op = ops[piece.op];
+    const LayerEnds & e = layers[op.layer];
+    QVector<bool> & done = s.done[op.layer];
+    for (int level = s.next[piece.op]; level <= piece.lastLevel; level++) {
+        if (done[level - minLevel]) {
+            continue;
+        }
+        done[level - minLevel] = true;
+
+        // Tool leaves groove of another operation above the first levels
+        // of both, unless this one starts inside of its pocket
+        double cost = s.cost;
+        int rapidLevel = level;
+        if (s.op != piece.op) {
+            rapidLevel = qMin(s.level, op.firstLevel);
+            if (s.op >= 0 && op.after != s.op) {
+                rapidLevel = qMin(rapidLevel, ops[s.op].firstLevel);
+            }
+        }
+        moveZ(s, rapidLevel);
+
+        // Same direction choice as replay in MainWindow::millShape()
+        if (!e.empty) {
+            bool rev = s.reversed[op.layer];
+            qint64 sx = rev ? e.ex : e.sx;
+            qint64 sy = rev ? e.ey : e.sy;
+            qint64 ex = rev ? e.sx : e.ex;
+            qint64 ey = rev ? e.sy : e.ey;
+            if (LayerPlan::isEndNearer(sx, sy, ex, ey, s.x, s.y)) {
+                s.reversed[op.layer] = !rev;
+                qSwap(sx, ex);
+                qSwap(sy, ey);
+            }
+            s.cost += machine.moveTime(sx - s.x, sy - s.y);
+            moveZ(s, level);
+            s.cost += e.cutTime;
+            s.x = ex;
+            s.y = ey;
+        } else {
+            moveZ(s, level);
+        }
+        s.op = piece.op;
+
+        if (steps) {
+            JobStep step;
+            step.layer = op.layer;
+            step.level = level;
+            step.pass = level - op.firstLevel + 1;
+            step.rapidLevel = rapidLevel;
+            step.time = s.cost - cost;
+            steps->append(step);
+        }
+    }
+    s.next[piece.op] = piece.lastLevel + 1;
+}
+
+// Level the tool is lifted to when it leaves operation op
+int JobPlanner::exitLevel(const State & s, int op) const
+{
+    int level = ops[op].firstLevel;
+    for (int i = 0; i < ops.count(); i++) {
+        if (ops[i].after == op && s.next[i] == ops[i].firstLevel) {
+            level = qMax(level, ops[i].firstLevel);
+        }
+    }
+    return level;
+}
+
+// Lower bound of the time left from state s: passes of levels not milled
+// yet, Z steps down to the deepest level no other operation of the layer
+// can mill and lift out of the operations but the last one
+double JobPlanner::bound(const State & s) const
+{
+    QVector<QVector<bool> > done = s.done;
+    bool left = false;
+    double time = 0;
+    for (int i = 0; i < ops.count(); i++) {
+        const Operation & op = ops[i];
+        for (int level = s.next[i]; level <= op.lastLevel; level++) {
+            if (!done[op.layer][level - minLevel]) {
+                done[op.layer][level - minLevel] = true;
+                time += layers[op.layer].cutTime;
+                left = true;
+            }
+        }
+    }
+    if (!left) {
+        return 0;
+    }
+
+    // Current operation is left from where the tool is if it is finished
+    double lift = 0;
+    double maxLift = 0;
+    if (s.op >= 0 && s.next[s.op] > ops[s.op].lastLevel) {
+        lift = machine.levelTime(qMin(exitLevel(s, s.op) - s.level, 0));
+    }
+    for (int i = 0; i < ops.count(); i++) {
+        const Operation & op = ops[i];
+        for (int level = op.lastLevel; level >= s.next[i]; level--) {
+            bool own = !s.done[op.layer][level - minLevel];
+            for (int j = 0; j < ops.count() && own; j++) {
+                own = (j == i || ops[j].layer != op.layer ||
+                       level < s.next[j] || level > ops[j].lastLevel);
+            }
+            if (own) {
+                int from = (i == s.op ? s.level : op.firstLevel);
+                time += machine.levelTime(level - from);
+                double up = machine.levelTime(qMin(exitLevel(s, i) - level,
+                                                   0));
+                lift += up;
+                maxLift = qMax(maxLift, up);
+                break;
+            }
+        }
+    }
+    return time + lift - maxLift;
+}
+
+// Try all allowed orders of the remaining pieces, cut off those which can
+// not get better then the best one
+void JobPlanner::search(const State & s)
+{
+    if (!bestOrder.isEmpty() && s.cost + bound(s) >= bestCost) {
+        return;
+    }
+
+    bool finished = true;
+    bool outlineOnly = false;
+    for (int i = 0; i < ops.count(); i++) {
+        if (s.next[i] <= ops[i].lastLevel) {
+            finished = false;
+            if (!ops[i].outline) {
+                outlineOnly = true;
+            }
+        }
+    }
+    if (finished) {
+        bestCost = s.cost;
+        bestZLevels = s.zLevels;
+        bestOrder = order;
+        return;
+    }
+
+    // Operation which has to follow the one just finished
+    int last = (order.isEmpty() ? -1 : order.last().op);
+    bool lastFinished = (last >= 0 && s.next[last] > ops[last].lastLevel);
+    int mustFollow = -1;
+    for (int i = 0; i < ops.count(); i++) {
+        if (lastFinished && ops[i].after == last &&
+            s.next[i] == ops[i].firstLevel) {
+            mustFollow = i;
+        }
+    }
+
+    for (int i = 0; i < ops.count(); i++) {
+        const Operation & op = ops[i];
+        bool started = (s.next[i] > op.firstLevel);
+        if (i == last || s.next[i] > op.lastLevel ||
+            (op.outline && outlineOnly) ||
+            (mustFollow >= 0 && i != mustFollow) ||
+            (op.after >= 0 && !started &&
+             (!lastFinished || last != op.after))) {
+            continue;
+        }
+
+        // Whole rest of the operation first, then pieces ending where
+        // an overlapping operation ends
+        Piece piece;
+        piece.op = i;
+        piece.lastLevel = op.lastLevel;
+        while (piece.lastLevel >= s.next[i]) {
+            State t = s;
+            run(piece, t, NULL);
+            order.append(piece);
+            search(t);
+            order.removeLast();
+
+            int split = s.next[i] - 1;
+            for (int j = 0; j < ops.count(); j++) {
+                int end = ops[j].lastLevel;
+                if (j != i && end < piece.lastLevel && end > split) {
+                    split = end;
+                }
+            }
+            piece.lastLevel = split;
+        }
+    }
+}
+
+void JobPlanner::plan(qint64 x, qint64 y, int level,
+                      QVector<JobStep> & steps)
+{
+    steps.clear();
+    minLevel = level;
+    maxLevel = level;
+    for (int i = 0; i < ops.count(); i++) {
+        minLevel = qMin(minLevel, ops[i].firstLevel);
+        maxLevel = qMax(maxLevel, ops[i].lastLevel);
+    }
+
+    State start;
+    start.x = x;
+    start.y = y;
+    start.level = level;
+    start.op = -1;
+    start.cost = 0;
+    start.zLevels = 0;
+    start.next.resize(ops.count());
+    for (int i = 0; i < ops.count(); i++) {
+        start.next[i] = ops[i].firstLevel;
+    }
+    start.reversed.fill(false, layers.count());
+    start.done.fill(QVector<bool>(maxLevel - minLevel + 1, false),
+                    layers.count());
+
+    // Operations whole in order as added and each on all of its levels,
+    // the way the job was milled without planning
+    State s = start;
+    QVector<Piece> given;
+    for (int i = 0; i < ops.count(); i++) {
+        Piece piece;
+        piece.op = i;
+        piece.lastLevel = ops[i].lastLevel;
+        s.done = start.done;
+        run(piece, s, NULL);
+        given.append(piece);
+    }
+    orderCost = s.cost;
+
+    bestOrder.clear();
+    order.clear();
+    search(start);
+    if (bestOrder.isEmpty()) {
+        bestOrder = given;      // constraints can not be met
+    }
+
+    s = start;
+    for (int i = 0; i < bestOrder.count(); i++) {
+        run(bestOrder[i], s, &steps);
+    }
+    bestCost = s.cost;
+    bestZLevels = s.zLevels;
+}
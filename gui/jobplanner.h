@@ -0,0 +1,123 @@
+#ifndef JOBPLANNER_H
+#define JOBPLANNER_H
+
+#include <QVector>
+
+#include "machinecost.h"
+#include "planner.h"
+#include "segmentstore.h"
+
+// One pass of a job: mill layer at Z level (moveZ() steps of 0.5mm, higher
+// is deeper)
+struct JobStep
+{
+    int layer;
+    int level;
+    int pass;                   // 1 for the first level of the operation
+    int rapidLevel;             // Z level of the rapid move to the pass
+    double time;                // estimate including Z and rapid move to it
+};
+
+// Orders milling operations of a job to save machine time of Z travel and
+// rapid moves.
+//
+// Operation mills one layer level by level from its first level down to
+// its last one. Rapid move between passes of an operation goes at the
+// level of the next pass, inside of the groove the operation made. Before
+// the rapid move to another operation the tool is lifted to the first
+// levels of both operations (usually above the stock, only the one of the
+// next operation if it starts inside of the pocket) and plunges down to
+// the next level after it, so operations which share a depth range can be
+// interleaved. The planner splits operations at the last levels of the
+// other operations they overlap with, picks the order of the pieces and
+// drops passes that mill a layer on a level it was already milled on. It
+// tries all orders allowed by the constraints and cuts off those which can
+// not beat the best one, there are just a few operations per job.
+class JobPlanner
+{
+public:
+    JobPlanner(const MachineCost & machine);
+
+    // Add operation milling layer (with its plan made already) on levels
+    // firstLevel..lastLevel, returns operation index
+    int addOperation(int layer, const SegmentStore & segs,
+                     const LayerPlan & plan, int firstLevel, int lastLevel);
+
+    // Operation op must go right after operation other, e.g. because it
+    // starts inside of the pocket other made
+    void setAfter(int op, int other);
+
+    // Outline cuts the part free, outlines go after all other operations
+    void setOutline(int op);
+
+    // Plan from tool position x, y at Z level
+    void plan(qint64 x, qint64 y, int level, QVector<JobStep> & steps);
+
+    // Estimated machine time (microseconds) of the plan and of operations
+    // milled whole on all of their levels in the order they were added
+    double cost() const;
+    double givenOrderCost() const;
+    int zLevels() const;
+
+private:
+    struct Operation
+    {
+        int layer;
+        int firstLevel;
+        int lastLevel;
+        int after;
+        bool outline;
+    };
+
+    // Ends of layer plan as made, replay state is tracked per layer
+    struct LayerEnds
+    {
+        qint64 sx;
+        qint64 sy;
+        qint64 ex;
+        qint64 ey;
+        bool empty;
+        double cutTime;
+    };
+
+    // Levels of operation op down to lastLevel milled in one go
+    struct Piece
+    {
+        int op;
+        int lastLevel;
+    };
+
+    // Position of the tool while trying an order
+    struct State
+    {
+        qint64 x;
+        qint64 y;
+        int level;
+        int op;                         // of the last pass, -1 at start
+        double cost;
+        int zLevels;
+        QVector<int> next;              // per operation, next level to mill
+        QVector<bool> reversed;         // per layer
+        QVector<QVector<bool> > done;   // per layer and level
+    };
+
+    const MachineCost & machine;
+    QVector<Operation> ops;
+    QVector<LayerEnds> layers;
+    int minLevel;
+    int maxLevel;
+
+    double bestCost;
+    double orderCost;
+    int bestZLevels;
+    QVector<Piece> bestOrder;
+    QVector<Piece> order;
+
+    void moveZ(State & s, int level) const;
+    int exitLevel(const State & s, int op) const;
+    void run(const Piece & piece, State & s, QVector<JobStep> *steps) const;
+    double bound(const State & s) const;
+    void search(const State & s);
+};
+
+#endif // JOBPLANNER_H
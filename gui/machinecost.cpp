@@ -0,0 +1,248 @@
+#include "machinecost.h"
+
+#include <math.h>
+
+MachineParams::MachineParams()
+:  sdelayX(8000), tdelayX(8000), sdelayY(8000), tdelayY(8000),
+   sdelayZ(8000), tdelayZ(8000), delayStep(50), moveUs(0), queueMoves(0),
+   svgPer1000Steps(30897), zLevelSteps(437), zWiggleSteps(128),
+   zDriftSteps(24)
+{
+}
+
+MachineCost::MachineCost(const MachineParams & params)
+:  p(params)
+{
+}
+
+const MachineParams & MachineCost::params() const
+{
+    return p;
+}
+
+void MachineCost::reset(State & s) const
+{
+    s.x.delay = p.sdelayX;
+    s.y.delay = p.sdelayY;
+    s.z.delay = p.sdelayZ;
+    s.x.dir = s.y.dir = s.z.dir = false;
+    s.x.idle = s.y.idle = s.z.idle = 3;
+}
+
+// Sum of min(limit, e) for e = 0..k
+static double sumMin(qint64 k, qint64 limit)
+{
+    if (k < 0) {
+        return 0;
+    }
+    if (k <= limit) {
+        return k * (double) (k + 1) / 2;
+    }
+    return limit * (double) (limit + 1) / 2 + (k - limit) * (double) limit;
+}
+
+// n steps accelerating towards target. Delay goes down by step after each
+// step except the first one if the axis made none of the last two steps.
+double MachineCost::ramp(Axis & axis, double target, qint64 n,
+                         double step) const
+{
+    if (n <= 0) {
+        return 0;
+    }
+    qint64 left = 0;
+    if (axis.delay > target && step > 0) {
+        left = (qint64) ceil((axis.delay - target) / step);
+    }
+    qint64 off = (axis.idle <= 1 ? 0 : 1);
+
+    // Step i runs after max(0, i - off) decrements
+    double dec = (off ? sumMin(n - 2, left) : sumMin(n - 1, left));
+    double time = n * axis.delay - step * dec;
+    axis.delay -= step * qMin(left, n - off);
+    axis.idle = 0;
+    return time;
+}
+
+// n steps spread among major steps of the other axis. Late axis steps
+// after the major one when both step at once (y in drawLine()).
+double MachineCost::minorSteps(Axis & axis, double start, double target,
+                               qint64 n, qint64 major, bool late) const
+{
+    if (n <= 0) {
+        idle(axis, start, major);
+        return 0;
+    }
+
+    // Major steps before the first and after the last step as drawLine()
+    // makes them
+    qint64 lead = major / (2 * n) + (late ? 1 : 0);
+    qint64 trail = (major - 1) / (2 * n) + (late ? 0 : 1);
+    idle(axis, start, lead);
+    double time = ramp(axis, target, 1, p.delayStep);
+    time += gapSteps(axis, start, target, n - 1, major - lead - trail);
+    idle(axis, start, trail);
+    return time;
+}
+
+// n steps with gaps major steps among them, the gaps differ by one at most
+double MachineCost::gapSteps(Axis & axis, double start, double target,
+                             qint64 n, qint64 gaps) const
+{
+    if (n <= 0) {
+        return 0;
+    }
+    qint64 gap = gaps / n;
+    qint64 longer = gaps % n;           // gaps of gap + 1 steps
+    if (gap <= 1) {
+        // Speeds up only after gaps of one step
+        double step = p.delayStep * (n - longer) / n;
+        return ramp(axis, target, n, step);
+    }
+    axis.idle = 0;
+    if (gap == 2 && longer == 0) {
+        return n * axis.delay;            // neither speeds up nor resets
+    }
+
+    // Reset in the first gap of three steps, they are spread evenly
+    qint64 before = (gap == 2 ? n / (2 * longer) : 0);
+    double time = before * axis.delay + (n - before) * start;
+    axis.delay = start;
+    return time;
+}
+
+// Axis did not move for steps steps of other axes
+void MachineCost::idle(Axis & axis, double start, qint64 steps) const
+{
+    axis.idle = qMin(axis.idle + steps, (qint64) 3);
+    if (axis.idle >= 3) {
+        axis.delay = start;
+    }
+}
+
+double MachineCost::line(State & s, qint64 dx, qint64 dy) const
+{
+    // Firmware does not call drawLine() when x, y do not change
+    if (dx == 0 && dy == 0) {
+        return 0;
+    }
+
+    // drawLine() resets delay of axis which changed direction
+    bool dirX = (dx < 0);
+    bool dirY = (dy < 0);
+    if (dirX != s.x.dir) {
+        s.x.delay = p.sdelayX;
+    }
+    if (dirY != s.y.dir) {
+        s.y.delay = p.sdelayY;
+    }
+    s.x.dir = dirX;
+    s.y.dir = dirY;
+
+    qint64 ax = (dx < 0 ? -dx : dx);
+    qint64 ay = (dy < 0 ? -dy : dy);
+    double time;
+    if (ax >= ay) {
+        time = ramp(s.x, p.tdelayX, ax, p.delayStep);
+        time += minorSteps(s.y, p.sdelayY, p.tdelayY, ay, ax, true);
+        if (ay > 0 && ax <= 2 * ay) {
+            s.x.idle = 1;               // y made the last step
+        }
+    } else {
+        if (ay < 2 * ax) {
+            idle(s.y, p.sdelayY, 1);    // x made the first step
+        }
+        time = ramp(s.y, p.tdelayY, ay, p.delayStep);
+        time += minorSteps(s.x, p.sdelayX, p.tdelayX, ax, ay, false);
+    }
+    idle(s.z, p.sdelayZ, ax + ay);
+    return time;
+}
+
+double MachineCost::lineZ(State & s, qint64 dz) const
+{
+    qint64 n = (dz < 0 ? -dz : dz);
+    if (n == 0) {
+        return 0;
+    }
+    double time = ramp(s.z, p.tdelayZ, n, p.delayStep);
+    idle(s.x, p.sdelayX, n);
+    idle(s.y, p.sdelayY, n);
+    return time;
+}
+
+double MachineCost::streamed(double motion) const
+{
+    // Next move is sent while the machine runs this one, serial link holds
+    // the machine up only when it is slower then the move
+    return qMax(motion, p.moveUs);
+}
+
+double MachineCost::moveTime(qint64 dx, qint64 dy) const
+{
+    qint64 sx = svgToSteps(dx);
+    qint64 sy = svgToSteps(dy);
+    if (sx == 0 && sy == 0) {
+        return 0;
+    }
+    State s;
+    reset(s);
+    return streamed(line(s, sx, sy));
+}
+
+double MachineCost::levelTime(int levels) const
+{
+    // Every move of moveZ() is a queue of its own
+    State s;
+    double time = 0;
+    while (levels > 0) {
+        reset(s);
+        time += streamed(lineZ(s, p.zLevelSteps));
+        reset(s);
+        time += streamed(line(s, p.zDriftSteps, 0));
+        reset(s);
+        time += streamed(lineZ(s, p.zWiggleSteps));
+        reset(s);
+        time += streamed(lineZ(s, p.zWiggleSteps));
+        levels--;
+    }
+    while (levels < 0) {
+        reset(s);
+        time += streamed(line(s, -p.zDriftSteps, 0));
+        reset(s);
+        time += streamed(lineZ(s, p.zLevelSteps));
+        levels++;
+    }
+    return time;
+}
+
+double MachineCost::planTime(const SegmentStore & segs,
+                             const LayerPlan & plan) const
+{
+    State s;
+    reset(s);
+    double time = 0;
+    int moves = 0;
+    qint64 x = 0;
+    qint64 y = 0;
+    for (int i = 0; i < plan.steps.count(); i++) {
+        int seg = LayerPlan::segment(plan.steps[i]);
+        bool rev = LayerPlan::isReversed(plan.steps[i]);
+        qint64 sx = svgToSteps(rev ? segs.x2[seg] : segs.x1[seg]);
+        qint64 sy = svgToSteps(rev ? segs.y2[seg] : segs.y1[seg]);
+        qint64 ex = svgToSteps(rev ? segs.x1[seg] : segs.x2[seg]);
+        qint64 ey = svgToSteps(rev ? segs.y1[seg] : segs.y2[seg]);
+        if (i > 0 && (sx != x || sy != y)) {
+            time += streamed(line(s, sx - x, sy - y));
+            moves++;
+        }
+        time += streamed(line(s, ex - sx, ey - sy));
+        moves++;
+        if (p.queueMoves > 0 && moves >= p.queueMoves) {
+            reset(s);
+            moves = 0;
+        }
+        x = ex;
+        y = ey;
+    }
+    return time;
+}
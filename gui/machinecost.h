@@ -0,0 +1,101 @@
+#ifndef MACHINECOST_H
+#define MACHINECOST_H
+
+#include <QtGlobal>
+
+#include "planner.h"
+#include "segmentstore.h"
+
+// Timing of the machine, defaults are what alfi_arduino.ino setup() uses.
+// Delays are microseconds between motor steps.
+struct MachineParams
+{
+    double sdelayX;             // start delay, decreases with each step...
+    double tdelayX;             // ...until it reaches target delay
+    double sdelayY;
+    double tdelayY;
+    double sdelayZ;
+    double tdelayZ;
+    double delayStep;           // delay decrease per step
+    double moveUs;              // sending one move command over serial,
+                                // overlaps with the previous move
+    int queueMoves;             // moves per queue, delays reset after it,
+                                // 0 if moves are streamed without a stop
+    qint64 svgPer1000Steps;     // svg units per 1000 x/y steps
+
+    // Z level (0.5mm) of MainWindow::moveZ()
+    int zLevelSteps;
+    int zWiggleSteps;           // up and down again on the way down
+    int zDriftSteps;            // x drift compensation per level
+
+    MachineParams();
+};
+
+// Estimates machine time of moves the same way the firmware runs them.
+//
+// drawLine() steps x and y one at a time (Bresenham), so a line takes
+// |dx| + |dy| steps. Delay of an axis goes down by delayStep per step when
+// the axis made one of the last two steps and goes back to the start
+// delay when it made none of the last three, when its direction changes
+// and when the machine is idle between queues. Minor axis of a line is
+// modeled by the gaps of major steps drawLine() makes between its steps,
+// where in the line it speeds up or resets is averaged. bench checks the
+// estimate against a copy of the firmware loop.
+class MachineCost
+{
+public:
+    struct Axis
+    {
+        double delay;
+        bool dir;
+        qint64 idle;            // steps of other axes since its last step
+    };
+
+    // Delays carried from move to move
+    struct State
+    {
+        Axis x;
+        Axis y;
+        Axis z;
+    };
+
+    MachineCost(const MachineParams & params = MachineParams());
+
+    const MachineParams & params() const;
+
+    // Machine idle, all delays at their start
+    void reset(State & s) const;
+
+    // Line of dx, dy steps and z move of dz steps, returns microseconds
+    double line(State & s, qint64 dx, qint64 dy) const;
+    double lineZ(State & s, qint64 dz) const;
+
+    // Rapid move by dx, dy svg units from idle machine, 0 if there are no
+    // steps to make
+    double moveTime(qint64 dx, qint64 dy) const;
+
+    // MainWindow::moveZ() by levels (positive is down)
+    double levelTime(int levels) const;
+
+    // Cutting plan from its first point, machine stops after every
+    // queueMoves moves (never if 0)
+    double planTime(const SegmentStore & segs, const LayerPlan & plan) const;
+
+    qint64 svgToSteps(qint64 val) const
+    {
+        return (val * 1000) / p.svgPer1000Steps;
+    }
+
+private:
+    MachineParams p;
+
+    double ramp(Axis & axis, double target, qint64 n, double step) const;
+    double minorSteps(Axis & axis, double start, double target, qint64 n,
+                      qint64 major, bool late) const;
+    double gapSteps(Axis & axis, double start, double target, qint64 n,
+                    qint64 gaps) const;
+    void idle(Axis & axis, double start, qint64 steps) const;
+    double streamed(double motion) const;
+};
+
+#endif // MACHINECOST_H
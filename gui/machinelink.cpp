@@ -0,0 +1,117 @@
+#include "machinelink.h"
+
+#include <QDebug>
+#include <QList>
+
+#include "cmdcodec.h"
+#include "cmdlink.h"
+#include "qserialport.h"
+
+MachineLink::MachineLink(const QString & device, int baud)
+:  device(device), baud(baud), head(0), tail(0), stopping(0), lastId(0)
+{
+}
+
+MachineLink::~MachineLink()
+{
+    stop();
+}
+
+int MachineLink::submit(const QByteArray & cmds)
+{
+    int t = tail.fetchAndAddAcquire(0);
+    if (t - head.fetchAndAddAcquire(0) >= LINK_BATCHES) {
+        return -1;
+    }
+    Batch & batch = ring[t & (LINK_BATCHES - 1)];
+    batch.id = ++lastId;
+    batch.cmds = cmds;
+    tail.fetchAndStoreRelease(t + 1);   // batch is filled before thread sees it
+    return lastId;
+}
+
+bool MachineLink::take(Batch & batch)
+{
+    int h = head.fetchAndAddAcquire(0);
+    if (h == tail.fetchAndAddAcquire(0)) {
+        return false;
+    }
+    batch = ring[h & (LINK_BATCHES - 1)];
+    ring[h & (LINK_BATCHES - 1)].cmds.clear();
+    head.fetchAndStoreRelease(h + 1);   // slot can be filled again
+    return true;
+}
+
+void MachineLink::stop()
+{
+    stopping.fetchAndStoreOrdered(1);
+    wait();
+}
+
+void MachineLink::run()
+{
+    QSerialPort port(device, baud);
+    bool opened = port.open(QFile::ReadWrite);
+    if (!opened) {
+        emit linkError(port.errorString());
+    }
+
+    CmdLink link(port, &stopping);
+
+    // Moves of MainWindow::move() are "a<axis> p<pos> t<target> m<n>", they
+    // have no binary form and go as ASCII. Only x, y, z commands typed to
+    // the serial box are sent as binary moves.
+    CmdEncoder encoder;
+    QList<int> running;         // sent to arduino, qdone did not come yet
+    Batch batch;
+    while (!stopping.fetchAndAddAcquire(0)) {
+        if (running.count() < LINK_IN_FLIGHT && take(batch)) {
+            if (!opened) {
+                emit batchDone(batch.id);       // no machine, just drop it
+                continue;
+            }
+            if (!encoder.isNegotiated()) {
+                encoder.negotiate(link);
+            }
+            QByteArray cmd = "q " + batch.cmds + " e" +
+                QString::number(batch.id).toAscii() + " ";
+            qDebug() << "cmd=" << cmd;
+            if (!link.write(encoder.encode(cmd))) {
+                if (!stopping.fetchAndAddAcquire(0)) {
+                    emit linkError("Arduino does not respond");
+                }
+                emit batchFailed(batch.id);
+                while (take(batch)) {
+                    emit batchFailed(batch.id);
+                }
+                continue;
+            }
+            running.append(batch.id);
+            continue;
+        }
+        if (!opened) {
+            msleep(10);
+            continue;
+        }
+
+        QByteArray data = link.read(10);
+        if (data.isEmpty()) {
+            continue;
+        }
+        emit serialData(data);
+
+        // Queues finish in order, qdone of one means all before are done
+        while (!running.isEmpty() && running.first() <= link.queueDone()) {
+            emit batchDone(running.takeFirst());
+        }
+        if (link.limitReached()) {
+            emit limitReached(link.recentLog());
+            link.clearLimit();
+
+            // Batches not sent yet would move on from a wrong position
+            while (take(batch)) {
+                emit batchFailed(batch.id);
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef MACHINELINK_H
+#define MACHINELINK_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+#include <QThread>
+
+// Batches submitted and not yet sent to arduino, power of 2
+#define LINK_BATCHES 8
+
+// Queues arduino holds, one runs and next one waits for it
+#define LINK_IN_FLIGHT 2
+
+// Serial port on its own thread. GUI thread submits batches of commands,
+// the thread sends each as one arduino queue when arduino has a free queue
+// slot and emits batchDone() when its qdone comes, so the GUI thread can
+// plan and draw meanwhile. If arduino does not take a batch, it and all
+// batches submitted after it are dropped with batchFailed(), they would
+// continue from a wrong position. Batches not sent yet are dropped the
+// same way when limit switch is reached.
+//
+// Batches are passed in a single producer, single consumer ring: only
+// submit() moves tail and only the thread moves head.
+class MachineLink : public QThread
+{
+    Q_OBJECT
+
+public:
+    MachineLink(const QString & device, int baud);
+    ~MachineLink();
+
+    // Queue commands, returns batch id (increasing from 1) or -1 if the
+    // ring is full. Call from one thread only.
+    int submit(const QByteArray & cmds);
+
+    // Close port and end the thread
+    void stop();
+
+signals:
+    void batchDone(int id);
+    void batchFailed(int id);
+    void serialData(const QByteArray & data);
+    void limitReached(const QString & log);
+    void linkError(const QString & error);
+
+protected:
+    void run();
+
+private:
+    struct Batch
+    {
+        int id;
+        QByteArray cmds;
+    };
+
+    QString device;
+    int baud;
+    Batch ring[LINK_BATCHES];
+    QAtomicInt head;            // next batch to send
+    QAtomicInt tail;            // next free slot
+    QAtomicInt stopping;
+    int lastId;
+
+    bool take(Batch & batch);
+};
+
+#endif // MACHINELINK_H
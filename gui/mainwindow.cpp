@@ -1,5 +1,16 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "geomcache.h"
+#include "jobplanner.h"
+#include "machinecost.h"
+#include "offset.h"
+#include "optimizer.h"
+#include "planner.h"
+#include "polyline.h"
+#include "segmentstore.h"
+#include "segmenttransform.h"
+#include "svgreader.h"
+#include "svgwriter.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +19,10 @@
 #include <sys/types.h>
 #include <fcntl.h>
 
+#include <QEventLoop>
+#include <QStatusBar>
+#include <QtConcurrentMap>
+
 // Alfi binary protocol:
 // byte no:
 //
@@ -28,6 +43,19 @@
 
 #define QUEUE_LEN 30
 
+// Time for reordering chains of one layer to shorten rapid moves
+#define PLAN_BUDGET_MS 1000
+
+// Delays between motor steps (start, target) on x/y and on z axis
+#define XY_START_DELAY 3600
+#define XY_TARGET_DELAY 2400
+#define Z_START_DELAY 8000
+#define Z_TARGET_DELAY 4000
+
+// Bytes of one move on serial line ("a0 p.. t.. a1 p.. t.. m.. ")
+#define MOVE_CMD_BYTES 34
+#define SERIAL_BAUD 115200
+
 QFile *outFile = NULL;
 
 void openOutFile(QString name)
@@ -89,20 +117,28 @@ static void MkPrnImg(QImage & img, int width, int height, uchar ** imgBits)
 
 MainWindow::MainWindow(QWidget * parent)
 :  
-QMainWindow(parent), ui(new Ui::MainWindow), port("/dev/ttyACM0", 115200),
-moveNo(0), cmdQueue(), milling(false), movesCount(0), curZ(0)
+QMainWindow(parent), ui(new Ui::MainWindow),
+machineLink("/dev/ttyACM0", SERIAL_BAUD), lastBatch(0), doneBatch(0),
+aborted(false), moveNo(0), cmdQueue(), milling(false), movesCount(0), curZ(0)
 {
     ui->setupUi(this);
     imgFile = QString::null;
-    if (!port.open(QFile::ReadWrite)) {
-        ui->tbSerial->setText(port.errorString());
-    }
     MkPrnImg(prn, PRN_WIDTH, PRN_HEIGHT, &prnBits);
-    readSerial();
+
+    connect(&machineLink, SIGNAL(batchDone(int)), SLOT(onBatchDone(int)));
+    connect(&machineLink, SIGNAL(batchFailed(int)), SLOT(onBatchFailed(int)));
+    connect(&machineLink, SIGNAL(serialData(QByteArray)),
+            SLOT(onSerialData(QByteArray)));
+    connect(&machineLink, SIGNAL(limitReached(QString)),
+            SLOT(onLimitReached(QString)));
+    connect(&machineLink, SIGNAL(linkError(QString)),
+            SLOT(onLinkError(QString)));
+    machineLink.start();
 }
 
 MainWindow::~MainWindow()
 {
+    machineLink.stop();
     delete ui;
 }
 
@@ -126,33 +162,6 @@ void setPixel(uchar * bits, int x, int y, uchar val)
     getSetPixel(bits, x, y, false, val);
 }
 
-static int getCoord(QString str)
-{
-    QStringList list = str.split('.');
-    int n = list.at(0).toInt() * 1000;
-    if (list.count() == 1) {
-        return n;
-    }
-    QString mStr = list.at(1);
-    int m = mStr.toInt();
-    for (int i = mStr.length();;) {
-        if (i == 3) {
-            if (str.indexOf('-') >= 0) {
-                return n - m;
-            }
-            return n + m;
-        }
-        if (i > 3) {
-            m /= 10;
-            i--;
-        }
-        if (i < 3) {
-            m *= 10;
-            i++;
-        }
-    }
-}
-
 static void drawLine(uchar * bits, int x0, int y0, int x1, int y1, int color)
 {
     int dx = abs(x1 - x0);
@@ -188,39 +197,6 @@ static void drawLine(uchar * bits, int x0, int y0, int x1, int y1, int color)
     }
 }
 
-// Compute driller path A->B->C->D taking into account driller width.
-//
-//         | D
-//         |
-//  -------+ C
-//  A      B
-//
-// Step 1: parallel line to AB shifted by width (same for AD)
-//
-//
-//  E     F
-//  -------        H |   | D
-//                   |   |
-//  -------        G |   | C
-//  A     B
-//
-static void millingPath(qint64 ax, qint64 ay,
-                        qint64 bx, qint64 by,
-                        qint64 r,
-                        qint64 & x0, qint64 & y0, qint64 & x1, qint64 & y1)
-{
-    // orthogonal line r pixels long
-    qint64 w = by - ay;
-    qint64 h = ax - bx;
-    qint64 c = (qint64) sqrt((10000 * 10000 * r * r) / (w * w + h * h));
-    w = (c * w) / 10000;
-    h = (c * h) / 10000;
-    x0 = ax + w;
-    y0 = ay + h;
-    x1 = bx + w;
-    y1 = by + h;
-}
-
 void MainWindow::paintEvent(QPaintEvent *)
 {
     QPainter p(this);
@@ -293,83 +269,92 @@ static void drawMoves(uchar * bits, int *moves, int movesCount, int width,
     }
 }
 
+// Submit queued commands as one batch. Machine link sends it as soon as
+// arduino has a free queue slot, we wait only while its ring is full.
+// After abort commands are dropped, they would continue from a wrong
+// position.
 void MainWindow::flushQueue()
 {
+    if (aborted) {
+        cmdQueue.clear();
+        return;
+    }
     update();
-    QApplication::processEvents();
 
     drawMoves(prnBits, moves, movesCount, width(), height(), curZ);
 
     //cmdQueue.clear();
     //return;
 
-    QString cmd = "q";
+    QString cmd;
     for (int i = 0; i < cmdQueue.count(); i++) {
         cmd += " ";
         cmd += cmdQueue.at(i);
     }
-    cmd += " e" + QString::number(++moveNo) + " ";
     cmdQueue.clear();
 
-    qDebug() << "cmd=" << cmd;
-    QByteArray cmdBytes = cmd.toAscii();
-    int remains = cmdBytes.length();
-    for (int i = 0; remains > 0; i += 64) {
-        int count = (remains >= 64 ? 64 : remains);
-        port.write(cmdBytes.constData() + i, count);
-
-        for (;;) {
-            int avail = port.bytesAvailable();
-            if (avail < count) {
-                port.waitForReadyRead(5);
-                continue;
-            }
-            QByteArray echoBytes = port.read(count);
-            qDebug() << "echo=" << echoBytes;
-            for (int j = 0; j < count; j++) {
-                if (echoBytes.at(j) != cmdBytes.at(i + j)) {
-                    qDebug() << "send data failed!!!";
-                    exit(1);
-                }
-            }
-            break;
+    int id;
+    while ((id = machineLink.submit(cmd.toAscii())) < 0) {
+        QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        if (aborted) {
+            return;
         }
-        remains -= count;
     }
-    //    port.write(cmd.toAscii());
+    lastBatch = id;
+}
 
-    QString expect = "qdone" + QString::number(moveNo);
-    qDebug() << "expect=" << expect;
-    for (;;) {
-        port.waitForReadyRead(10);
-        QByteArray str = port.read(1024);
-        if (str.length() == 0) {
-            continue;
-        }
-        qDebug() << "serial in=" << str;
-        for (int i = 0; i < str.count(); i++) {
-            char ch = str.at(i);
-            if ((ch >= 'a' && ch <= 'z') ||
-                (ch >= 'A' && ch <= 'Z') ||
-                (ch >= '0' && ch <= '9') || ch == ' ') {
-                serialLog.append(ch);
-            }
-        }
-        qDebug() << "serialLog=" << serialLog;
-        ui->tbSerial->append(str);
-        ui->tbSerial->update();
+// Wait until arduino has done batch id, GUI keeps running meanwhile.
+// Returns false if limit switch was reached or a batch failed.
+bool MainWindow::waitQueueDone(int id)
+{
+    while (doneBatch < id && !aborted) {
+        QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    return !aborted;
+}
 
-        int index = serialLog.lastIndexOf(expect);
-        if (index >= 0) {
-            return;
-        }
-        if (serialLog.lastIndexOf("limit") >= 0) {
-            QString tail =
-                serialLog.count() < 1024 ? serialLog : serialLog.right(1024);
-            QMessageBox::information(this, "Limit reached", tail);
-            return;
-        }
+// Send what is queued and wait until arduino has done everything. Returns
+// false if aborted.
+bool MainWindow::finishQueue()
+{
+    if (!cmdQueue.isEmpty()) {
+        flushQueue();
+    }
+    return waitQueueDone(lastBatch);
+}
+
+// Buttons which send commands to arduino
+void MainWindow::setMachineButtonsEnabled(bool enabled)
+{
+    ui->bMill->setEnabled(enabled);
+    ui->bMillCover->setEnabled(enabled);
+    ui->bXMinus->setEnabled(enabled);
+    ui->bXPlus->setEnabled(enabled);
+    ui->bYMinus->setEnabled(enabled);
+    ui->bYPlus->setEnabled(enabled);
+    ui->bZMinus->setEnabled(enabled);
+    ui->bZPlus->setEnabled(enabled);
+    ui->bSendSerial->setEnabled(enabled);
+}
+
+// Jobs run in the event loop while waiting for arduino, so buttons which
+// move the machine are disabled until the job ends. Returns false if a job
+// already runs.
+bool MainWindow::startJob()
+{
+    if (milling) {
+        return false;
     }
+    milling = true;
+    aborted = false;
+    setMachineButtonsEnabled(false);
+    return true;
+}
+
+void MainWindow::endJob()
+{
+    milling = false;
+    setMachineButtonsEnabled(true);
 }
 
 void MainWindow::sendCmd(QString cmd, bool flush)
@@ -377,6 +362,9 @@ void MainWindow::sendCmd(QString cmd, bool flush)
     cmdQueue.append(cmd);
     if (flush) {
         flushQueue();
+        if (!milling) {
+            finishQueue();      // manual moves are done when we return
+        }
     }
 }
 
@@ -402,55 +390,73 @@ void MainWindow::move(int axis, int pos, int target, bool justSetPos,
     sendCmd(cmd, flush);
 }
 
-void MainWindow::readSerial()
+void MainWindow::onBatchDone(int id)
 {
-    if (milling) {
-        return;
-    }
-    int avail = port.bytesAvailable();
-    if (avail <= 0) {
-        QTimer::singleShot(100, this, SLOT(readSerial()));
-        return;
-    }
-    QByteArray data = port.readAll();
-    qDebug() << data;
+    doneBatch = id;
+}
+
+void MainWindow::onSerialData(const QByteArray & data)
+{
+    qDebug() << "serial in=" << data;
     ui->tbSerial->append(data);
-    QTimer::singleShot(100, this, SLOT(readSerial()));
+}
+
+void MainWindow::onBatchFailed(int id)
+{
+    qDebug() << "batch" << id << "failed";
+    aborted = true;
+}
+
+void MainWindow::onLimitReached(const QString & log)
+{
+    aborted = true;
+    QMessageBox::information(this, "Limit reached", log);
+}
+
+void MainWindow::onLinkError(const QString & error)
+{
+    ui->tbSerial->append(error);
 }
 
 void MainWindow::on_bSendSerial_clicked()
 {
-    port.write(ui->tbSendSerial->text().toAscii());
+    machineLink.submit(ui->tbSendSerial->text().toAscii());
 }
 
 void MainWindow::on_bXMinus_clicked()
 {
+    aborted = false;
     move(0, 0, ui->spinBox->value());
 }
 
 void MainWindow::on_bXPlus_clicked()
 {
+    aborted = false;
     move(0, ui->spinBox->value(), 0);
 }
 
 void MainWindow::on_bYMinus_clicked()
 {
+    aborted = false;
     move(1, 0, ui->spinBox->value());
 }
 
 void MainWindow::on_bYPlus_clicked()
 {
+    aborted = false;
     move(1, ui->spinBox->value(), 0);
 }
 
 void MainWindow::on_bZMinus_clicked()
 {
+    aborted = false;
     move(0, 24, 0);
     move(2, 437, 0);
 }
 
 void MainWindow::on_bZPlus_clicked()
 {
+    aborted = false;
     move(2, 0, 437);
 
     move(2, 437, 437 - 128);    // move up & down so that the gear does not slip ;-)
@@ -481,157 +487,219 @@ void MainWindow::moveBySvgCoord(int axis, qint64 pos, qint64 target, int driftX,
     move(axis, stepsPos, stepsTarget, justSetpos, false);
 }
 
-static QString num2svg(qint64 num)
+// Stores segments read from svg to segment store
+class SvgStoreSink : public SvgSegmentSink
 {
-    int th = abs(num) / 1000;
-    int rest = abs(num) % 1000;
-    QString res = (num >= 0 ? "" : "-");
-    res += QString::number(th);
-    res += '.';
-    if (rest <= 9) {
-        res += "00";
-    } else if (rest <= 99) {
-        res += "0";
+public:
+    SegmentStore & segs;
+    bool overflow;
+
+    SvgStoreSink(SegmentStore & segs)
+    :  segs(segs), overflow(false)
+    {
     }
-    res += QString::number(rest);
-    return res;
-}
 
-// Load svg lines to x1,y1,x2,y2 arrays and return count
-static int loadSvg(QString path, qint64 * x1, qint64 * y1, qint64 * x2,
-                   qint64 * y2, QStringList & lines, int maxCount,
-                   qint64 & minX, qint64 & maxX, qint64 & minY, qint64 & maxY)
+    bool addSegment(qint64 ax, qint64 ay, qint64 bx, qint64 by)
+    {
+        if (!segs.append(ax, ay, bx, by)) {
+            overflow = true;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Load svg lines to segment store, bounds are extended by the layer bounds.
+// Parsed layers are taken from geometry cache if the file did not change.
+// Returns false with error set if the file can not be read or some
+// coordinate is out of range (the layer would be cut off).
+static bool loadSvg(QString path, SegmentStore & segs, SegmentBounds & bounds,
+                    QString & error,
+                    const SvgParseOptions & options = SvgParseOptions())
 {
+    static GeomCache cache;
+
     qDebug() << "loading " << path;
 
     QFile f(path);
     if (!f.open(QFile::ReadOnly)) {
-        qCritical() << "failed to load " << path << ": " << f.errorString();
-        return 0;
-    }
-
-    int count = 0;
-
-    QRegExp rxy("d=\"([mM]) (-?\\d+\\.?\\d*),(-?\\d+\\.?\\d*)");
-    QRegExp rwh("(-?\\d+\\.?\\d*),(-?\\d+\\.?\\d*)");
-    QRegExp rsci("[0123456789\\.-]+e[0123456789\\.-]+");    // scientific format, e.g. -8e-4
-
-    // Read and parse svg file, results are in x1,x2,y1,y2 arrays
-    for (;;) {
-        QByteArray line = f.readLine();
-        if (line.isEmpty()) {
-            break;
-        }
-        line = line.trimmed();
-
-        // Convert scientific small numbers to 0
-        int pos = rsci.indexIn(line);
-        if (pos >= 0) {
-            line.replace(rsci.cap(0), "0");
-            qDebug() << "removed scientific format, new line=" << line;
-        }
-
-        pos = rxy.indexIn(line);
-        if (pos < 0) {
-            continue;
+        error = "failed to load: " + f.errorString();
+        return false;
+    }
+    QByteArray bytes;
+    qint64 size = f.size();
+    const char *data = (const char *) (size > 0 ? f.map(0, size) : NULL);
+    if (!data) {
+        bytes = f.readAll();
+        data = bytes.constData();
+        size = bytes.size();
+    }
+
+    QByteArray key = GeomCache::key(data, size, options.key());
+    SegmentBounds layerBounds;
+    if (cache.load(key, segs, layerBounds)) {
+        qDebug() << "loaded " << segs.count() << " segments from cache";
+    } else {
+        segs.clear();
+        SvgStoreSink sink(segs);
+        PolylineSimplifier simplifier(&sink, options.simplifyTolerance);
+        SvgReader reader(&simplifier, options);
+        reader.read(data, size);
+        simplifier.finish();
+        if (sink.overflow) {
+            error = "coordinates out of range";
+            return false;
         }
-        bool abs = rxy.cap(1) == "M";
-        qDebug() << "line[" << count << "]=" << line;
+        layerBounds = segmentBounds(segs);
+        cache.save(key, segs, layerBounds);
+        qDebug() << "loaded " << segs.count() << " segments from " <<
+            reader.pathCount() << " paths, simplification removed " <<
+            simplifier.removedCount() << " of " << simplifier.inputCount();
+    }
+    f.close();
 
-        QString capxy = rxy.cap(0);
-        qint64 x = getCoord(rxy.cap(2));
-        qint64 y = getCoord(rxy.cap(3));
+    bounds.unite(layerBounds);
+    qDebug() << "MIN X=" << bounds.minX << " MAX X=" << bounds.maxX <<
+        " MIN Y=" << bounds.minY << " MAX Y=" << bounds.maxY;
 
-        line.remove(0, pos + capxy.length());
+    return true;
+}
 
-        for (int i = 0;; i++) {
-            pos = rwh.indexIn(line);
-            if (pos < 0) {
-                break;
-            }
+// Mirror x around the middle of bounds and move everything to positive
+// coordinates. Returns false with error set if some coordinate would be
+// negative or out of range.
+static bool mirror(SegmentStore & segs, const SegmentBounds & bounds,
+                   QString & error)
+{
+    qint64 minX = bounds.minX;
+    qint64 maxX = bounds.maxX;
+    qint64 minY = bounds.minY;
+    qint64 midX = (minX + maxX) / 2 - minX;
 
-            QString capwh = rwh.cap(0);
-            qint64 w = getCoord(rwh.cap(1));
-            qint64 h = getCoord(rwh.cap(2));
+    SegmentTransform t;
+    t.scaleX = -1;
+    t.offsetX = midX + midX - minX;
+    t.offsetY = -minY;
 
-            if (abs) {
-                w -= x;
-                h -= y;
-            }
+    SegmentBounds res;
+    if (!transformSegments(segs, t, bounds, res, error)) {
+        return false;
+    }
+    if (!segs.isEmpty() && (res.minX < 0 || res.minY < 0)) {
+        error = "negative coordinate";
+        return false;
+    }
+    return true;
+}
 
-            qDebug() << "x=" << x << " y=" << y << " w=" << w << " h=" << h;
+// Svg layer of a milling job
+struct SvgLayer
+{
+    QString path;
+    SegmentStore segs;
+    SegmentBounds bounds;       // bounds of this layer
+    SegmentBounds jobBounds;    // bounds of all layers, used for mirroring
+    QString error;              // set if the layer can not be milled
+    LayerPlan plan;             // cutting order, same for all passes
 
-            x1[count] = x;
-            y1[count] = y;
-            x2[count] = x + w;
-            y2[count] = y + h;
+    SvgLayer(const QString & path = QString())
+    :  path(path)
+    {
+    }
+};
 
-            minX = (x1[count] < minX ? x1[count] : minX);
-            maxX = (x1[count] > maxX ? x1[count] : maxX);
-            minX = (x2[count] < minX ? x2[count] : minX);
-            maxX = (x2[count] > maxX ? x2[count] : maxX);
+static void loadLayer(SvgLayer & layer)
+{
+    loadSvg(layer.path, layer.segs, layer.bounds, layer.error);
+}
 
-            minY = (y1[count] < minY ? y1[count] : minY);
-            maxY = (y1[count] > maxY ? y1[count] : maxY);
-            minY = (y2[count] < minY ? y2[count] : minY);
-            maxY = (y2[count] > maxY ? y2[count] : maxY);
+static void mirrorLayer(SvgLayer & layer)
+{
+    if (layer.error.isEmpty()) {
+        mirror(layer.segs, layer.jobBounds, layer.error);
+    }
+}
 
-            count++;
-            lines.append(line);
+// Load and mirror layers on the global thread pool. Layers depend on each
+// other only through the bounds of the whole job, so they are loaded in
+// parallel, bounds are reduced and then the layers are mirrored in parallel.
+// Returns false if some layer failed.
+static bool loadLayers(QVector<SvgLayer> & layers)
+{
+    QtConcurrent::blockingMap(layers, loadLayer);
 
-//            drawLine(prnBits,
-//                     x / 1000,
-//                     y / 1000 - 500,
-//                     (x + w) / 1000,
-//                     (y + h) / 1000 - 500,
-//                     1);
-
-            if (count > maxCount) {
-                qWarning() << "svg file longer then maxCount=" << maxCount;
-                break;
-            }
+    SegmentBounds bounds;
+    for (int i = 0; i < layers.count(); i++) {
+        bounds.unite(layers.at(i).bounds);
+    }
+    for (int i = 0; i < layers.count(); i++) {
+        layers[i].jobBounds = bounds;
+    }
+    qDebug() << "JOB MIN X=" << bounds.minX << " MAX X=" << bounds.maxX <<
+        " MIN Y=" << bounds.minY << " MAX Y=" << bounds.maxY;
 
-            x += w;
-            y += h;
+    QtConcurrent::blockingMap(layers, mirrorLayer);
 
-            line.remove(0, pos + capwh.length());
-            qDebug() << "rem=" << line;
+    bool ok = true;
+    for (int i = 0; i < layers.count(); i++) {
+        if (!layers.at(i).error.isEmpty()) {
+            qCritical() << "layer " << layers.at(i).path << ": " <<
+                layers.at(i).error;
+            ok = false;
         }
     }
+    return ok;
+}
 
-    f.close();
-    qDebug() << "MIN X=" << minX << " MAX X=" << maxX << " MIN Y=" << minY <<
-        " MAX Y=" << maxY;
+// Machine timing for the delays moveZ() sets
+static MachineCost machineCost()
+{
+    MachineParams params;
+    params.sdelayX = params.sdelayY = XY_START_DELAY;
+    params.tdelayX = params.tdelayY = XY_TARGET_DELAY;
+    params.sdelayZ = Z_START_DELAY;
+    params.tdelayZ = Z_TARGET_DELAY;
+    params.moveUs = MOVE_CMD_BYTES * 10 * 1000000.0 / SERIAL_BAUD;
+    // machineLink sends next batch while the machine runs, it does not stop
+    params.queueMoves = 0;
+    return MachineCost(params);
+}
 
-    return count;
+// Time in microseconds as h:mm:ss
+static QString formatTime(double us)
+{
+    qint64 secs = (qint64) (us / 1000000);
+    return QString("%1:%2:%3").arg(secs / 3600)
+        .arg((secs / 60) % 60, 2, 10, QChar('0'))
+        .arg(secs % 60, 2, 10, QChar('0'));
 }
 
-static void mirror(qint64 * x1, qint64 * y1, qint64 * x2, qint64 * y2,
-                   int count, qint64 minX, qint64 maxX, qint64 minY,
-                   qint64 /*maxY */ )
+// Plan cutting order of a layer from tool position x, y
+static void planLayer(const SegmentStore & segs, LayerPlan & plan, qint64 x,
+                      qint64 y, bool firstPoint)
 {
-    qint64 midX = (minX + maxX) / 2 - minX;
-    for (int i = 0; i < count; i++) {
-        x1[i] = midX - x1[i] + midX;
-        x2[i] = midX - x2[i] + midX;
-
-        // Make sure we have only positive coordinates
-        x1[i] -= minX;
-        x2[i] -= minX;
-        y1[i] -= minY;
-        y2[i] -= minY;
-
-        if (x1[i] < 0 || x2[i] < 0 || y1[i] < 0 || y2[i] < 0) {
-            qDebug() << "negative coordinate";
-            exit(123);
-        }
-    }
+    LayerPlanner planner(segs);
+    planner.plan(x, y, firstPoint, plan);
+    qDebug() << "layer plan: " << plan.steps.count() << " segments in " <<
+        plan.chainStarts.count() << " chains, " << plan.rapids <<
+        " rapid moves";
+
+    MachineCost machine = machineCost();
+    ChainOptimizer optimizer(segs, machine);
+    double distBefore = ChainOptimizer::rapidDistance(segs, plan, x, y);
+    optimizer.optimize(x, y, firstPoint, PLAN_BUDGET_MS, plan);
+    double distAfter = ChainOptimizer::rapidDistance(segs, plan, x, y);
+    qDebug() << "rapid time before " << formatTime(optimizer.before()) <<
+        " after " << formatTime(optimizer.after());
+    qDebug() << "rapid distance before " << distBefore / 1000 << "px after " <<
+        distAfter / 1000 << "px";
 }
 
-void MainWindow::millShape(qint64 * x1, qint64 * y1, qint64 * x2, qint64 * y2,
-                           int *colors, int count, int color, int driftX,
-                           QStringList & /*lines */ ,
-                           qint64 & lastX, qint64 & lastY, bool firstPoint)
+// Mill layer along plan. Empty plan is planned from the current position
+// on first use and replayed on later passes, backwards if that is nearer.
+void MainWindow::millShape(SegmentStore & segs, LayerPlan & plan,
+                           int driftX, qint64 & lastX, qint64 & lastY,
+                           bool firstPoint)
 {
     // Current and target positions on svg
     qint64 cx;
@@ -639,55 +707,24 @@ void MainWindow::millShape(qint64 * x1, qint64 * y1, qint64 * x2, qint64 * y2,
     qint64 tx = lastX;
     qint64 ty = lastY;
 
-    memset(colors, color ? 0 : 1, 65535);
+    const qint32 *x1 = segs.x1.constData();
+    const qint32 *y1 = segs.y1.constData();
+    const qint32 *x2 = segs.x2.constData();
+    const qint32 *y2 = segs.y2.constData();
 
-    for (;;) {
-        // Find nearest line
-        qint64 ndist = 0x7fffffffffffffff;
-        int nindex = -1;
-        bool swap = false;
-        for (int i = 0; i < count; i++) {
-            qint64 w = x1[i] - tx;
-            qint64 h = y1[i] - ty;
-            qint64 dist1 = w * w + h * h;
-            w = x2[i] - tx;
-            h = y2[i] - ty;
-            qint64 dist2 = w * w + h * h;
-            qint64 dist = (dist1 < dist2 ? dist1 : dist2);
-            //qDebug() << "i=" << i << ", dist=" << dist << "line=" << lines.at(i);
-            if (dist > ndist) {
-                continue;
-            }
-            if (colors[i] == color) {
-                continue;       // already drawn
-            }
-            ndist = dist;
-            nindex = i;
-            swap = (dist2 < dist1);
-            if (firstPoint)     // make sure we start from index=0 if requested
-            {
-                firstPoint = false;
-                ndist = -1;
-            }
-        }
+    if (plan.steps.isEmpty()) {
+        planLayer(segs, plan, lastX, lastY, firstPoint);
+    } else if (plan.isEndNearer(segs, lastX, lastY)) {
+        plan.reverse();
+    }
 
-        if (nindex >= 0) {
-            cx = swap ? x2[nindex] : x1[nindex];
-            cy = swap ? y2[nindex] : y1[nindex];
-            tx = swap ? x1[nindex] : x2[nindex];
-            ty = swap ? y1[nindex] : y2[nindex];
-            colors[nindex] = color;
-
-            //qDebug() << "next line is " << lines.at(nindex);
-        } else {
-//            update();
-//            QApplication::processEvents();
-//            Sleeper::msleep(5000);
-
-            // all done
-            flushQueue();
-            return;
-        }
+    for (int i = 0; i < plan.steps.count(); i++) {
+        int nindex = LayerPlan::segment(plan.steps[i]);
+        bool swap = LayerPlan::isReversed(plan.steps[i]);
+        cx = swap ? x2[nindex] : x1[nindex];
+        cy = swap ? y2[nindex] : y1[nindex];
+        tx = swap ? x1[nindex] : x2[nindex];
+        ty = swap ? y1[nindex] : y2[nindex];
 
         if (cx != lastX || cy != lastY) // if lines on are not continuous
         {
@@ -714,6 +751,9 @@ void MainWindow::millShape(qint64 * x1, qint64 * y1, qint64 * x2, qint64 * y2,
         lastX = tx;
         lastY = ty;
     }
+
+    // all done
+    flushQueue();
 }
 
 // Move z axis in 0.5 mm steps
@@ -722,7 +762,8 @@ void MainWindow::moveZ(int z, int &driftX)
     curZ += z;
     qDebug() << "======================= Z=" << curZ;
 
-    sendCmd("s8000 d4000");
+    sendCmd("s" + QString::number(Z_START_DELAY) + " d" +
+            QString::number(Z_TARGET_DELAY));
     while (z > 0) {
         move(2, 0, 437, false, true);   // drill the shape shifted 0.5mm down
         move(0, 0, 24, false, true);    // compensate x drift
@@ -739,237 +780,204 @@ void MainWindow::moveZ(int z, int &driftX)
         driftX -= 24;
         z++;
     }
-    sendCmd("s3600 d2400");
+    sendCmd("s" + QString::number(XY_START_DELAY) + " d" +
+            QString::number(XY_TARGET_DELAY));
+}
+
+// Plan cutting order of all layers of a job
+static void planLayers(QVector<SvgLayer> & layers, qint64 x, qint64 y)
+{
+    for (int i = 0; i < layers.count(); i++) {
+        planLayer(layers[i].segs, layers[i].plan, x, y, true);
+    }
+}
+
+// Order job operations and mill them starting at Z level 0 from tool
+// position x, y, then move Z to endLevel
+void MainWindow::millJob(QVector<SvgLayer> & layers, JobPlanner & job,
+                         qint64 x, qint64 y, int endLevel)
+{
+    QVector<JobStep> steps;
+    job.plan(x, y, 0, steps);
+    qDebug() << "job plan: " << steps.count() << " passes, " <<
+        job.zLevels() << " Z levels, time " << formatTime(job.cost()) <<
+        " (in given order " << formatTime(job.givenOrderCost()) << ")";
+
+    int driftX = 0;
+    int level = 0;
+    double remaining = job.cost();
+    for (int i = 0; i < steps.count() && !aborted; i++) {
+        const JobStep & step = steps.at(i);
+        statusBar()->showMessage(QString("Pass %1 of %2, %3 remaining")
+                                 .arg(i + 1).arg(steps.count())
+                                 .arg(formatTime(remaining)));
+        remaining -= step.time;
+
+        SvgLayer & layer = layers[step.layer];
+        if (step.rapidLevel != level) {
+            moveZ(step.rapidLevel - level, driftX);
+            level = step.rapidLevel;
+        }
+        if (step.level != level) {
+            // Lifted tool goes above the start of the pass and plunges
+            qint64 sx;
+            qint64 sy;
+            qint64 ex;
+            qint64 ey;
+            if (layer.plan.isEndNearer(layer.segs, x, y)) {
+                layer.plan.reverse();
+            }
+            if (layer.plan.ends(layer.segs, sx, sy, ex, ey)) {
+                moveBySvgCoord(0, x, sx, driftX, true);
+                moveBySvgCoord(1, y, sy, driftX, false);
+                x = sx;
+                y = sy;
+            }
+            moveZ(step.level - level, driftX);
+            level = step.level;
+        }
+        millShape(layer.segs, layer.plan, driftX, x, y);
+    }
+    if (endLevel != level && !aborted) {
+        moveZ(endLevel - level, driftX);
+    }
+    statusBar()->showMessage(finishQueue() ? "Job done" : "Job aborted");
+    endJob();
 }
 
 void MainWindow::on_bMill_clicked()
 {
-    milling = true;
+    if (!startJob()) {
+        return;
+    }
 
-    qint64 minX = 0x7fffffffffffffff;
-    qint64 maxX = 0;
-    qint64 minY = 0x7fffffffffffffff;
-    qint64 maxY = 0;
+    QVector<SvgLayer> layers;
 
     // PCB
-    QStringList pcbLines;
-    static qint64 pcbX1[65535];
-    static qint64 pcbY1[65535];
-    static qint64 pcbX2[65535];
-    static qint64 pcbY2[65535];
-    static int pcbColors[65535];
-
-    int pcbCount =
-        loadSvg("/home/radek/alfi/gui/pcb_milling.svg", pcbX1, pcbY1, pcbX2,
-                pcbY2, pcbLines, 65535, minX, maxX, minY, maxY);
+    layers.append(SvgLayer("/home/radek/alfi/gui/pcb_milling.svg"));
 
     // Outer shape
-    QStringList shapeLines;
-    static qint64 shapeX1[65535];
-    static qint64 shapeY1[65535];
-    static qint64 shapeX2[65535];
-    static qint64 shapeY2[65535];
-    static int shapeColors[65535];
-
-    int shapeCount =
-        loadSvg("/home/radek/alfi/gui/shape_milling.svg", shapeX1, shapeY1,
-                shapeX2, shapeY2, shapeLines, 65535, minX, maxX, minY, maxY);
+    layers.append(SvgLayer("/home/radek/alfi/gui/shape_milling.svg"));
 
     // LCD module hole
-    QStringList lcmLines;
-    static qint64 lcmX1[65535];
-    static qint64 lcmY1[65535];
-    static qint64 lcmX2[65535];
-    static qint64 lcmY2[65535];
-    static int lcmColors[65535];
-
-    int lcmCount =
-        loadSvg("/home/radek/alfi/gui/lcm_milling.svg", lcmX1, lcmY1, lcmX2,
-                lcmY2, lcmLines, 65535, minX, maxX, minY, maxY);
+    layers.append(SvgLayer("/home/radek/alfi/gui/lcm_milling.svg"));
 
     // Front display hole (a bit smaller then LCM)
-    QStringList lcdLines;
-    static qint64 lcdX1[65535];
-    static qint64 lcdY1[65535];
-    static qint64 lcdX2[65535];
-    static qint64 lcdY2[65535];
-    static int lcdColors[65535];
-
-    int lcdCount =
-        loadSvg("/home/radek/alfi/gui/lcd_milling.svg", lcdX1, lcdY1, lcdX2,
-                lcdY2, lcdLines, 65535, minX, maxX, minY, maxY);
+    layers.append(SvgLayer("/home/radek/alfi/gui/lcd_milling.svg"));
 
     // Prepare for display hole (our driller is not high enought to make it in one go)
-    QStringList lcpLines;
-    static qint64 lcpX1[65535];
-    static qint64 lcpY1[65535];
-    static qint64 lcpX2[65535];
-    static qint64 lcpY2[65535];
-    static int lcpColors[65535];
-
-    int lcpCount =
-        loadSvg("/home/radek/alfi/gui/lcd_prepare.svg", lcpX1, lcpY1, lcpX2,
-                lcpY2, lcpLines, 65535, minX, maxX, minY, maxY);
-
-    mirror(pcbX1, pcbY1, pcbX2, pcbY2, pcbCount, minX, maxX, minY, maxY);
-    mirror(shapeX1, shapeY1, shapeX2, shapeY2, shapeCount, minX, maxX, minY,
-           maxY);
-    mirror(lcmX1, lcmY1, lcmX2, lcmY2, lcmCount, minX, maxX, minY, maxY);
-    mirror(lcdX1, lcdY1, lcdX2, lcdY2, lcdCount, minX, maxX, minY, maxY);
-    mirror(lcpX1, lcpY1, lcpX2, lcpY2, lcpCount, minX, maxX, minY, maxY);
+    layers.append(SvgLayer("/home/radek/alfi/gui/lcd_prepare.svg"));
 
-    int driftX = 0;
-    qint64 lastX = shapeX1[0];
-    qint64 lastY = shapeY1[0];
-
-    // Start with outer shape just 0.5mm down
-    millShape(shapeX1, shapeY1, shapeX2, shapeY2, shapeColors, shapeCount, 1, driftX, shapeLines, lastX, lastY);    // 0mm
-    moveZ(1, driftX);
-    millShape(shapeX1, shapeY1, shapeX2, shapeY2, shapeColors, shapeCount, 2, driftX, shapeLines, lastX, lastY);    // 0.5mm
-    moveZ(-2, driftX);
-
-    // Move to pcb -0.5 above and mill it 7mm down
-    for (int i = 1; i <= 15; i++) {
-        millShape(pcbX1, pcbY1, pcbX2, pcbY2, pcbColors, pcbCount, i, driftX, pcbLines, lastX, lastY);  // -0.5..5mm
-        moveZ(1, driftX);
+    if (!loadLayers(layers)) {
+        endJob();
+        return;
     }
 
-    // Move to LCM -0.5 above
-    moveZ(-15, driftX);
+    // Z levels are 0.5mm moveZ() steps from the stock surface, -1 is above
+    SegmentStore & shape = layers[1].segs;
+    qint64 lastX = (shape.isEmpty() ? 0 : shape.x1[0]);
+    qint64 lastY = (shape.isEmpty() ? 0 : shape.y1[0]);
+    planLayers(layers, lastX, lastY);
 
-    // LCM module 7mm + 4mm down
-    for (int i = 1; i <= 23; i++) {
-        millShape(lcmX1, lcmY2, lcmX2, lcmY2, lcmColors, lcmCount, i, driftX, lcmLines, lastX, lastY);  // -0.5..11mm
-        moveZ(1, driftX);
-    }
+    MachineCost machine = machineCost();
+    JobPlanner job(machine);
 
-    // Move to prepare LCD -0.5 above
-    moveZ(-23, driftX);
+    // Start with outer shape just 0.5mm down
+    job.addOperation(1, shape, layers[1].plan, 0, 1);
 
-    // Prepare for LCD display
-    for (int i = 1; i <= 7; i++) {
-        millShape(lcpX1, lcpY2, lcpX2, lcpY2, lcpColors, lcpCount, i, driftX, lcpLines, lastX, lastY);  // -0.5..3mm
-        moveZ(1, driftX);
-    }
+    // PCB 7mm down
+    job.addOperation(0, layers[0].segs, layers[0].plan, -1, 13);
 
-    // Move to LCD -0.5 above
-    moveZ(-5, driftX);
+    // LCM module 7mm + 4mm down
+    job.addOperation(2, layers[2].segs, layers[2].plan, -1, 21);
 
-    // LCD display 7+4+3mm down
-    for (int i = 1; i <= 29; i++) {
-        millShape(lcdX1, lcdY2, lcdX2, lcdY2, lcdColors, lcdCount, i, driftX, lcdLines, lastX, lastY);  // -0.5..14mm
-        moveZ(1, driftX);
-    }
+    // Prepare for LCD display
+    int lcp = job.addOperation(4, layers[4].segs, layers[4].plan, -1, 5);
 
-    // Move to outer shape -1.5 above
-    moveZ(-31, driftX);
+    // LCD display 7+4+3mm down, starts in the prepared hole
+    int lcd = job.addOperation(3, layers[3].segs, layers[3].plan, 1, 29);
+    job.setAfter(lcd, lcp);
 
     // Outer shape 7+4+3+3mm down
-    for (int i = 1; i <= 37; i++) {
-        millShape(shapeX1, shapeY1, shapeX2, shapeY2, shapeColors, shapeCount, 1, driftX, shapeLines, lastX, lastY);    // -0.5..15mm
-        moveZ(1, driftX);
-    }
+    int outline = job.addOperation(1, shape, layers[1].plan, -1, 35);
+    job.setOutline(outline);
 
-    moveZ(-37, driftX);
+    millJob(layers, job, lastX, lastY, -1);
 }
 
 // Compute milling path taking into account driller radius
 void MainWindow::on_bMillPath_clicked()
 {
-    QStringList lines;
-    static qint64 x1[65535];
-    static qint64 y1[65535];
-    static qint64 x2[65535];
-    static qint64 y2[65535];
+    SegmentBounds bounds;
 
-    qint64 minX = 0x7fffffffffffffff;
-    qint64 maxX = 0;
-    qint64 minY = 0x7fffffffffffffff;
-    qint64 maxY = 0;
+    SegmentStore segs;
+    QString error;
+    if (!loadSvg("/home/radek/alfi/gui/lcm.svg", segs, bounds, error)) {
+        qCritical() << "lcm.svg: " << error;
+        return;
+    }
 
-    int count =
-        loadSvg("/home/radek/alfi/gui/lcm.svg", x1, y1, x2, y2, lines, 65535,
-                minX, maxX, minY, maxY);
+    // Driller path inside the hole: driller radius (1.6) - some space so
+    // that pcb fits in (0.8). Round joins are what the driller really cuts.
+    SegmentStore path;
+    OffsetOptions options;
+    options.join = OffsetJoinRound;
+    int loops = offsetSegments(segs, -(9525 - 4762), options, path);
+    qDebug() << "offset " << segs.count() << " segments to " << loops <<
+        " loops of " << path.count() << " segments";
 
     openOutFile("/home/radek/alfi/gui/lcm_milling.svg");
 
-    QString millStr;
-    for (int i = 0; i < count; i++) {
-        qint64 cx, cy, tx, ty;
-        millingPath(x1[i], y1[i], x2[i], y2[i], 9525 - 4762,    // driller radius (1.6) - some space so that pcb fits in (0.8)
-                    cx, cy, tx, ty);
-
-        millStr.append("<path d=\"m ");
-        millStr.append(num2svg(cx) + "," + num2svg(cy) + " " +
-                       num2svg(tx - cx) + "," + num2svg(ty - cy));
-        millStr.
-            append
-            ("\"\nstyle=\"fill:#000000;fill-opacity:1;fill-rule:evenodd;stroke:#000000;stroke-width:0.76908362;stroke-linecap:round;stroke-linejoin:round;stroke-miterlimit:10;stroke-opacity:1;stroke-dasharray:none\"\n");
-        millStr.append("id=\"path" + QString::number(x1[i] + y1[i]) + "\"\n");
-        millStr.append("/>\n\n");
+    SvgWriter writer(outFile);
+    writer.beginGroup("fill:#000000;fill-opacity:1;fill-rule:evenodd;stroke:#000000;stroke-width:0.76908362;stroke-linecap:round;stroke-linejoin:round;stroke-miterlimit:10;stroke-opacity:1;stroke-dasharray:none");
+    writer.writeSegments(path);
+    writer.endGroup();
+    if (!writer.flush()) {
+        qCritical() << "failed to write " << outFile->fileName() << ": " <<
+            outFile->errorString();
     }
+    qDebug() << "wrote " << path.count() << " segments as " <<
+        writer.pathCount() << " paths, " << writer.bytesWritten() << " bytes";
 
-    outFile->write(millStr.toLatin1());
     closeOutFile();
 }
 
 void MainWindow::on_bMillCover_clicked()
 {
-    milling = true;
+    if (!startJob()) {
+        return;
+    }
 
-    qint64 minX = 0x7fffffffffffffff;
-    qint64 maxX = 0;
-    qint64 minY = 0x7fffffffffffffff;
-    qint64 maxY = 0;
+    QVector<SvgLayer> layers;
 
     // Outer shape
-    QStringList shapeLines;
-    static qint64 shapeX1[65535];
-    static qint64 shapeY1[65535];
-    static qint64 shapeX2[65535];
-    static qint64 shapeY2[65535];
-    static int shapeColors[65535];
-
-    int shapeCount =
-        loadSvg("/home/radek/alfi/gui/cover_shape_milling.svg", shapeX1, shapeY1,
-                shapeX2, shapeY2, shapeLines, 65535, minX, maxX, minY, maxY);
+    layers.append(SvgLayer("/home/radek/alfi/gui/cover_shape_milling.svg"));
 
     // Battery hole
-    QStringList batteryLines;
-    static qint64 batteryX1[65535];
-    static qint64 batteryY1[65535];
-    static qint64 batteryX2[65535];
-    static qint64 batteryY2[65535];
-    static int batteryColors[65535];
+    layers.append(SvgLayer("/home/radek/alfi/gui/battery_hole_milling.svg"));
 
-    int batteryCount =
-        loadSvg("/home/radek/alfi/gui/battery_hole_milling.svg", batteryX1, batteryY1, batteryX2,
-                batteryY2, batteryLines, 65535, minX, maxX, minY, maxY);
+    if (!loadLayers(layers)) {
+        endJob();
+        return;
+    }
 
-    mirror(shapeX1, shapeY1, shapeX2, shapeY2, shapeCount, minX, maxX, minY,
-           maxY);
-    mirror(batteryX1, batteryY1, batteryX2, batteryY2, batteryCount, minX, maxX, minY, maxY);
+    SegmentStore & shape = layers[0].segs;
+    qint64 lastX = (shape.isEmpty() ? 0 : shape.x1[0]);
+    qint64 lastY = (shape.isEmpty() ? 0 : shape.y1[0]);
+    planLayers(layers, lastX, lastY);
 
-    int driftX = 0;
-    qint64 lastX = shapeX1[0];
-    qint64 lastY = shapeY1[0];
+    MachineCost machine = machineCost();
+    JobPlanner job(machine);
 
     // Start with outer shape
-    millShape(shapeX1, shapeY1, shapeX2, shapeY2, shapeColors, shapeCount, 1, driftX, shapeLines, lastX, lastY);    // 0mm
-    moveZ(-1, driftX);
+    job.addOperation(0, shape, layers[0].plan, 0, 0);
 
     // Battery hole 6mm down
-    for (int i = 1; i <= 13; i++) {
-        millShape(batteryX1, batteryY2, batteryX2, batteryY2, batteryColors, batteryCount, i, driftX, batteryLines, lastX, lastY);  // -0.5..6mm
-        moveZ(1, driftX);
-    }
-
-    // Move to outer shape -0.5 above
-    moveZ(-14, driftX);
+    job.addOperation(1, layers[1].segs, layers[1].plan, -1, 11);
 
     // Outer shape 10mm down
-    for (int i = 1; i <= 21; i++) {
-        millShape(shapeX1, shapeY1, shapeX2, shapeY2, shapeColors, shapeCount, 1, driftX, shapeLines, lastX, lastY);    // -0.5..15mm
-        moveZ(1, driftX);
-    }
+    int outline = job.addOperation(0, shape, layers[0].plan, -2, 18);
+    job.setOutline(outline);
+
+    millJob(layers, job, lastX, lastY, -2);
 }
@@ -16,10 +16,15 @@
 #include <QRegExp>
 #include <math.h>
 
-#include "qserialport.h"
+#include "machinelink.h"
 
 #define MILL_LOG_LEN 90000
 
+class JobPlanner;
+class SegmentStore;
+struct LayerPlan;
+struct SvgLayer;
+
 namespace Ui
 {
     class MainWindow;
@@ -51,8 +56,10 @@ public:
     QImage prn;
     uchar *prnBits;
     QString imgFile;
-    QSerialPort port;
-    QString serialLog;
+    MachineLink machineLink;
+    int lastBatch;      // last batch submitted to machineLink
+    int doneBatch;      // last batch arduino has done
+    bool aborted;       // limit switch reached or batch failed
     int moveNo;
     QStringList cmdQueue;
     bool milling;
@@ -62,14 +69,19 @@ public:
 
     void sendCmd(QString cmd, bool flush = true);
     void flushQueue();
+    bool waitQueueDone(int id);
+    bool finishQueue();
+    void setMachineButtonsEnabled(bool enabled);
+    bool startJob();
+    void endJob();
     void move(int axis, int pos, int target, bool justSetPos = false, bool flush = true);
     void moveBySvgCoord(int axis, qint64 pos, qint64 target, int driftX, bool justSetPos);
-    void millShape(qint64 * x1, qint64 *y1, qint64 * x2, qint64 *y2,
-                   int *colors, int count, int color, int driftX,
-                   QStringList & lines,
+    void millShape(SegmentStore & segs, LayerPlan & plan, int driftX,
                    qint64 & lastX, qint64 & lastY, bool firstPoint = true);
 
     void moveZ(int z, int & driftX);
+    void millJob(QVector<SvgLayer> & layers, JobPlanner & job, qint64 x,
+                 qint64 y, int endLevel);
 
 private slots:
     void on_bMillCover_clicked();
@@ -82,7 +94,11 @@ private slots:
     void on_bXPlus_clicked();
     void on_bXMinus_clicked();
     void on_bSendSerial_clicked();
-    void readSerial();
+    void onBatchDone(int id);
+    void onBatchFailed(int id);
+    void onSerialData(const QByteArray & data);
+    void onLimitReached(const QString & log);
+    void onLinkError(const QString & error);
 };
 
 class Sleeper : public QThread
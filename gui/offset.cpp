@@ -0,0 +1,417 @@
+#include "offset.h"
+
+#include <QtAlgorithms>
+#include <math.h>
+
+// Max number of points of one round join
+#define MAX_ROUND_STEPS 1000
+
+// Segment end point, index is segment * 2 + (0 for start, 1 for end)
+struct EndPoint
+{
+    qint32 x;
+    qint32 y;
+    int index;
+};
+
+static bool endPointLess(const EndPoint & a, const EndPoint & b)
+{
+    if (a.x != b.x) {
+        return a.x < b.x;
+    }
+    if (a.y != b.y) {
+        return a.y < b.y;
+    }
+    return a.index < b.index;
+}
+
+static void endPointCoord(const SegmentStore & segs, int index, qint64 & x,
+                          qint64 & y)
+{
+    int i = index >> 1;
+    x = (index & 1) ? segs.x2[i] : segs.x1[i];
+    y = (index & 1) ? segs.y2[i] : segs.y1[i];
+}
+
+// Follow segments from end point start until the chain ends or comes back
+static void walkContour(const SegmentStore & segs, int start,
+                        const QVector<int> & partner, QVector<bool> & used,
+                        Contour & c)
+{
+    qint64 x;
+    qint64 y;
+    endPointCoord(segs, start, x, y);
+    c.xs.append(x);
+    c.ys.append(y);
+
+    int cur = start;
+    for (;;) {
+        used[cur >> 1] = true;
+        int other = cur ^ 1;
+        endPointCoord(segs, other, x, y);
+        c.xs.append(x);
+        c.ys.append(y);
+        int next = partner[other];
+        if (next < 0 || used[next >> 1]) {
+            break;
+        }
+        cur = next;
+    }
+
+    // Segment walked there and back is open
+    int n = c.xs.count();
+    if (n > 2 && c.xs[0] == c.xs[n - 1] && c.ys[0] == c.ys[n - 1]) {
+        c.xs.removeLast();
+        c.ys.removeLast();
+        c.closed = (n > 3);
+    }
+}
+
+void buildContours(const SegmentStore & segs, QVector<Contour> & contours)
+{
+    contours.clear();
+    int n = segs.count();
+
+    QVector<bool> used(n, false);
+    QVector<EndPoint> ends;
+    ends.reserve(2 * n);
+    for (int i = 0; i < n; i++) {
+        if (segs.x1[i] == segs.x2[i] && segs.y1[i] == segs.y2[i]) {
+            used[i] = true;     // zero length, nothing to offset
+            continue;
+        }
+        EndPoint a = { segs.x1[i], segs.y1[i], 2 * i };
+        EndPoint b = { segs.x2[i], segs.y2[i], 2 * i + 1 };
+        ends.append(a);
+        ends.append(b);
+    }
+    qSort(ends.begin(), ends.end(), endPointLess);
+
+    // Pair end points with the same coordinates. Where more than two
+    // segments meet they are paired in sorted order and the odd one is
+    // left as chain end.
+    QVector<int> partner(2 * n, -1);
+    for (int i = 0; i < ends.count();) {
+        int j = i + 1;
+        while (j < ends.count() && ends[j].x == ends[i].x &&
+               ends[j].y == ends[i].y) {
+            j++;
+        }
+        for (int k = i; k + 1 < j; k += 2) {
+            partner[ends[k].index] = ends[k + 1].index;
+            partner[ends[k + 1].index] = ends[k].index;
+        }
+        i = j;
+    }
+
+    // Open chains first so that they are walked from their ends, whatever
+    // is left are loops
+    for (int i = 0; i < ends.count(); i++) {
+        int e = ends[i].index;
+        if (partner[e] >= 0 || used[e >> 1]) {
+            continue;
+        }
+        contours.append(Contour());
+        walkContour(segs, e, partner, used, contours.last());
+    }
+    for (int i = 0; i < n; i++) {
+        if (used[i]) {
+            continue;
+        }
+        contours.append(Contour());
+        walkContour(segs, 2 * i, partner, used, contours.last());
+    }
+}
+
+// Offset geometry of one contour in floating point. Edge i goes from point
+// i to point i + 1, u is its unit direction and n the offset vector.
+class ContourOffset
+{
+public:
+    ContourOffset(const OffsetOptions & options)
+    :  options(options)
+    {
+    }
+
+    bool offset(const Contour & c, double delta, QVector<double> & outX,
+                QVector<double> & outY);
+
+private:
+    OffsetOptions options;
+    QVector<double> px;
+    QVector<double> py;
+    QVector<double> ux;
+    QVector<double> uy;
+    QVector<double> nx;
+    QVector<double> ny;
+    QVector<int> prev;
+    QVector<int> next;
+    QVector<bool> alive;
+    double dist;                // |delta|
+    double side;                // +1 if offset is on the left of edges
+
+    double turn(int a, int b) const;
+    bool isConcave(int a, int b) const;
+    void intersect(int a, int b, double & x, double & y) const;
+    void join(int a, int b, QVector<double> & outX, QVector<double> & outY);
+};
+
+// Cross product of edge directions, positive for turn towards the offset
+// side
+double ContourOffset::turn(int a, int b) const
+{
+    return side * (ux[a] * uy[b] - uy[a] * ux[b]);
+}
+
+// Offset lines of edges a and b cross before the corner
+bool ContourOffset::isConcave(int a, int b) const
+{
+    return turn(a, b) > 1e-12;
+}
+
+// Intersection of offset lines of edges a and b
+void ContourOffset::intersect(int a, int b, double & x, double & y) const
+{
+    double ax = px[a] + nx[a];
+    double ay = py[a] + ny[a];
+    double bx = px[b] + nx[b];
+    double by = py[b] + ny[b];
+    double den = ux[a] * uy[b] - uy[a] * ux[b];
+    double t = ((bx - ax) * uy[b] - (by - ay) * ux[b]) / den;
+    x = ax + t * ux[a];
+    y = ay + t * uy[a];
+}
+
+// Points of convex or straight corner between edge a and the following
+// edge b, the corner point is the start of b
+void ContourOffset::join(int a, int b, QVector<double> & outX,
+                         QVector<double> & outY)
+{
+    double cx = px[b];
+    double cy = py[b];
+    double cross = (nx[a] * ny[b] - ny[a] * nx[b]) / (dist * dist);
+    double dot = (nx[a] * nx[b] + ny[a] * ny[b]) / (dist * dist);
+
+    if (fabs(cross) < 1e-12 && dot > 0) {
+        outX.append(cx + nx[b]);        // straight
+        outY.append(cy + ny[b]);
+        return;
+    }
+
+    OffsetJoin type = options.join;
+    if (type == OffsetJoinMiter) {
+        if (1 + dot >= 2 / (options.miterLimit * options.miterLimit)) {
+            outX.append(cx + (nx[a] + nx[b]) / (1 + dot));
+            outY.append(cy + (ny[a] + ny[b]) / (1 + dot));
+            return;
+        }
+        type = OffsetJoinSquare;
+    }
+
+    double angle = atan2(fabs(cross), dot);
+    if (type == OffsetJoinSquare) {
+        double ext = dist * tan(angle / 4);
+        outX.append(cx + nx[a] + ux[a] * ext);
+        outY.append(cy + ny[a] + uy[a] * ext);
+        outX.append(cx + nx[b] - ux[b] * ext);
+        outY.append(cy + ny[b] - uy[b] * ext);
+        return;
+    }
+
+    // Round, angle step so that chord error is within tolerance
+    double step = M_PI / 2;
+    if (options.tolerance < dist) {
+        step = qMin(step, 2 * acos(1 - options.tolerance / dist));
+    }
+    int steps = (int) ceil(angle / step);
+    steps = qBound(1, steps, MAX_ROUND_STEPS);
+    double dir = (cross < 0 ? -1 : 1);
+    for (int i = 0; i <= steps; i++) {
+        double phi = dir * angle * i / steps;
+        double c = cos(phi);
+        double s = sin(phi);
+        outX.append(cx + nx[a] * c - ny[a] * s);
+        outY.append(cy + nx[a] * s + ny[a] * c);
+    }
+}
+
+bool ContourOffset::offset(const Contour & c, double delta,
+                           QVector<double> & outX, QVector<double> & outY)
+{
+    outX.clear();
+    outY.clear();
+
+    // Open contour is walked there and back so that the result is a loop
+    // around it
+    px.clear();
+    py.clear();
+    int n = c.xs.count();
+    for (int i = 0; i < n; i++) {
+        px.append(c.xs[i]);
+        py.append(c.ys[i]);
+    }
+    if (!c.closed) {
+        for (int i = n - 2; i > 0; i--) {
+            px.append(c.xs[i]);
+            py.append(c.ys[i]);
+        }
+    }
+
+    // Orientation decides which side is outside
+    double area = 0;
+    int m = px.count();
+    if (m < 2) {
+        return false;
+    }
+    for (int i = 0; i < m; i++) {
+        int j = (i + 1) % m;
+        area += px[i] * py[j] - px[j] * py[i];
+    }
+    dist = fabs(delta);
+    if (!c.closed) {
+        side = -1;
+    } else if (area == 0) {
+        return false;
+    } else {
+        side = ((area > 0) == (delta > 0) ? -1 : 1);
+    }
+
+    ux.resize(m);
+    uy.resize(m);
+    nx.resize(m);
+    ny.resize(m);
+    prev.resize(m);
+    next.resize(m);
+    alive.fill(true, m);
+    for (int i = 0; i < m; i++) {
+        int j = (i + 1) % m;
+        double dx = px[j] - px[i];
+        double dy = py[j] - py[i];
+        double len = sqrt(dx * dx + dy * dy);
+        ux[i] = dx / len;
+        uy[i] = dy / len;
+        nx[i] = -side * uy[i] * dist;
+        ny[i] = side * ux[i] * dist;
+        prev[i] = (i + m - 1) % m;
+        next[i] = j;
+    }
+
+    // Remove edges which the neighbouring concave corners swallowed: the
+    // offset edge between the two intersections points backwards
+    QVector<int> work;
+    for (int i = m - 1; i >= 0; i--) {
+        work.append(i);
+    }
+    int count = m;
+    while (!work.isEmpty() && count > 2) {
+        int i = work.last();
+        work.removeLast();
+        int a = prev[i];
+        int b = next[i];
+        if (!alive[i] || !isConcave(a, i) || !isConcave(i, b) ||
+            !isConcave(a, b)) {
+            continue;
+        }
+        double sx, sy, ex, ey;
+        intersect(a, i, sx, sy);
+        intersect(i, b, ex, ey);
+        if ((ex - sx) * ux[i] + (ey - sy) * uy[i] >= 0) {
+            continue;
+        }
+        alive[i] = false;
+        next[a] = b;
+        prev[b] = a;
+        count--;
+        work.append(a);
+        work.append(b);
+    }
+
+    int first = 0;
+    while (!alive[first]) {
+        first++;
+    }
+
+    // Edge left reversed has no concave neighbour to be merged with, e.g.
+    // two parallel sides of a slot narrower than the offset. Such contour
+    // (or some part of it) vanishes, give up on it.
+    if (c.closed && count <= 2) {
+        return false;
+    }
+    int i = first;
+    do {
+        int a = prev[i];
+        int b = next[i];
+        if (isConcave(a, i) && isConcave(i, b)) {
+            double sx, sy, ex, ey;
+            intersect(a, i, sx, sy);
+            intersect(i, b, ex, ey);
+            if ((ex - sx) * ux[i] + (ey - sy) * uy[i] < 0) {
+                return false;
+            }
+        }
+        i = b;
+    } while (i != first);
+
+    i = first;
+    do {
+        int a = prev[i];
+        if (isConcave(a, i)) {
+            double x, y;
+            intersect(a, i, x, y);
+            outX.append(x);
+            outY.append(y);
+        } else {
+            join(a, i, outX, outY);
+        }
+        i = next[i];
+    } while (i != first);
+
+    return true;
+}
+
+int offsetSegments(const SegmentStore & segs, qint64 delta,
+                   const OffsetOptions & options, SegmentStore & path)
+{
+    path.clear();
+
+    QVector<Contour> contours;
+    buildContours(segs, contours);
+
+    ContourOffset engine(options);
+    QVector<double> xs;
+    QVector<double> ys;
+    int loops = 0;
+    for (int i = 0; i < contours.count(); i++) {
+        if (delta == 0 || !engine.offset(contours.at(i), delta, xs, ys)) {
+            continue;
+        }
+
+        // Round to integer loop, skip points which round to the same spot
+        int start = path.count();
+        qint64 firstX = qRound64(xs[0]);
+        qint64 firstY = qRound64(ys[0]);
+        qint64 lastX = firstX;
+        qint64 lastY = firstY;
+        for (int j = 1; j <= xs.count(); j++) {
+            qint64 x = (j < xs.count() ? qRound64(xs[j]) : firstX);
+            qint64 y = (j < ys.count() ? qRound64(ys[j]) : firstY);
+            if (x == lastX && y == lastY) {
+                continue;
+            }
+            if (!path.append(lastX, lastY, x, y)) {
+                break;          // out of 32 bit range
+            }
+            lastX = x;
+            lastY = y;
+        }
+        if (lastX != firstX || lastY != firstY || path.count() - start < 2) {
+            path.x1.resize(start);      // broken loop, drop it
+            path.y1.resize(start);
+            path.x2.resize(start);
+            path.y2.resize(start);
+            continue;
+        }
+        loops++;
+    }
+    return loops;
+}
@@ -0,0 +1,63 @@
+#ifndef OFFSET_H
+#define OFFSET_H
+
+#include <QVector>
+
+#include "segmentstore.h"
+
+// Corner shape of offset contours, same meaning as in Clipper
+enum OffsetJoin
+{
+    OffsetJoinMiter,
+    OffsetJoinRound,
+    OffsetJoinSquare
+};
+
+struct OffsetOptions
+{
+    OffsetJoin join;
+
+    // Max distance of miter point from the corner in multiples of offset,
+    // sharper corners are squared off
+    double miterLimit;
+
+    // Max error of round joins in svg pixels * 1000
+    qint64 tolerance;
+
+    OffsetOptions()
+    :  join(OffsetJoinMiter), miterLimit(2), tolerance(50)
+    {
+    }
+};
+
+// Polyline made of connected segments. Closed contours do not repeat the
+// first point at the end.
+struct Contour
+{
+    QVector<qint64> xs;
+    QVector<qint64> ys;
+    bool closed;
+
+    Contour()
+    :  closed(false)
+    {
+    }
+};
+
+// Join segments with common end points into contours. End points are
+// sorted and matched so segment order and direction do not matter.
+void buildContours(const SegmentStore & segs, QVector<Contour> & contours);
+
+// Offset contours of segs by delta and store the resulting closed loops
+// to path as connected segments.
+//
+// Closed contours grow for positive delta and shrink for negative one,
+// whatever their orientation is. Contours which vanish when shrinking are
+// dropped. Open contours get a loop around them |delta| away, ends are
+// capped according to the join. Edges swallowed by concave corners are
+// removed, but overlaps of different parts of the result are not (there
+// is no polygon union). Returns number of loops.
+int offsetSegments(const SegmentStore & segs, qint64 delta,
+                   const OffsetOptions & options, SegmentStore & path);
+
+#endif // OFFSET_H
@@ -0,0 +1,615 @@
+#include "optimizer.h"
+
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <math.h>
+
+// Candidate chains per chain
+#define NEIGHBOURS 8
+
+// Longest run of chains moved by Or-opt
+#define MAX_OR_OPT 3
+
+// Moves must gain more then this
+#define MIN_GAIN 1e-6
+
+// Search stops after this many perturbations in a row did not improve the
+// best tour, budget is just an upper limit
+#define IDLE_KICKS 100
+
+// Entry and exit point of chain cut forward. Chain 0 is the tool position.
+struct ChainEnds
+{
+    double sx;
+    double sy;
+    double ex;
+    double ey;
+};
+
+static inline double dist(double ax, double ay, double bx, double by)
+{
+    double dx = bx - ax;
+    double dy = by - ay;
+    return sqrt(dx * dx + dy * dy);
+}
+
+// Up to NEIGHBOURS nearest chains of each chain, measured between any of
+// their end points. Grid with about one chain per cell, rings of cells are
+// walked until the k-th candidate is nearer then the next ring.
+static void nearestChains(const QVector<ChainEnds> & ends,
+                          QVector<int> & neighbours)
+{
+    int n = ends.count();
+    neighbours.fill(-1, n * NEIGHBOURS);
+    if (n < 2) {
+        return;
+    }
+
+    double minX = ends[1].sx;
+    double maxX = minX;
+    double minY = ends[1].sy;
+    double maxY = minY;
+    for (int i = 1; i < n; i++) {
+        minX = qMin(minX, qMin(ends[i].sx, ends[i].ex));
+        maxX = qMax(maxX, qMax(ends[i].sx, ends[i].ex));
+        minY = qMin(minY, qMin(ends[i].sy, ends[i].ey));
+        maxY = qMax(maxY, qMax(ends[i].sy, ends[i].ey));
+    }
+    double cell = sqrt((maxX - minX + 1) * (maxY - minY + 1) / n);
+    cell = qMax(cell, 1.0);
+    int cols = qMin((int) ((maxX - minX) / cell) + 1, 4 * n + 16);
+    int rows = qMin((int) ((maxY - minY) / cell) + 1, (4 * n + 16) / cols + 1);
+    cell = qMax((maxX - minX) / cols, (maxY - minY) / rows) + 1;
+
+    // Counting sort of end points (chain * 2 + end) by cell
+    QVector<int> cellStart(cols * rows + 1, 0);
+    QVector<int> points(2 * (n - 1));
+    QVector<int> cellOfPoint(2 * n, 0);
+    for (int p = 2; p < 2 * n; p++) {
+        const ChainEnds & e = ends[p >> 1];
+        double x = (p & 1) ? e.ex : e.sx;
+        double y = (p & 1) ? e.ey : e.sy;
+        int col = qBound(0, (int) ((x - minX) / cell), cols - 1);
+        int row = qBound(0, (int) ((y - minY) / cell), rows - 1);
+        cellOfPoint[p] = row * cols + col;
+        cellStart[cellOfPoint[p] + 1]++;
+    }
+    for (int c = 0; c < cols * rows; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+    QVector<int> fill = cellStart;
+    for (int p = 2; p < 2 * n; p++) {
+        points[fill[cellOfPoint[p]]++] = p;
+    }
+
+    int maxRing = qMax(cols, rows);
+    for (int c = 0; c < n; c++) {
+        int *best = neighbours.data() + c * NEIGHBOURS;
+        double bestDist[NEIGHBOURS];
+        int found = 0;
+
+        for (int end = 0; end < 2; end++) {
+            double qx = end ? ends[c].ex : ends[c].sx;
+            double qy = end ? ends[c].ey : ends[c].sy;
+            int col = qBound(0, (int) ((qx - minX) / cell), cols - 1);
+            int row = qBound(0, (int) ((qy - minY) / cell), rows - 1);
+            for (int r = 0; r <= maxRing; r++) {
+                double bound = (r - 1) * cell;
+                if (found == NEIGHBOURS && bound > bestDist[found - 1]) {
+                    break;
+                }
+                for (int j = row - r; j <= row + r; j++) {
+                    if (j < 0 || j >= rows) {
+                        continue;
+                    }
+                    bool edge = (j == row - r || j == row + r);
+                    int step = (edge || r == 0 ? 1 : 2 * r);
+                    for (int i = col - r; i <= col + r; i += step) {
+                        if (i < 0 || i >= cols) {
+                            continue;
+                        }
+                        int k = j * cols + i;
+                        for (int e = cellStart[k]; e < cellStart[k + 1];
+                             e++) {
+                            int p = points[e];
+                            int other = p >> 1;
+                            if (other == c) {
+                                continue;
+                            }
+                            const ChainEnds & o = ends[other];
+                            double d = (p & 1) ? dist(qx, qy, o.ex, o.ey) :
+                                dist(qx, qy, o.sx, o.sy);
+
+                            // Keep candidates sorted and unique
+                            int t = 0;
+                            while (t < found && best[t] != other) {
+                                t++;
+                            }
+                            if (t < found) {
+                                if (d >= bestDist[t]) {
+                                    continue;
+                                }
+                            } else if (found < NEIGHBOURS) {
+                                t = found++;
+                            } else if (d < bestDist[found - 1]) {
+                                t = found - 1;
+                            } else {
+                                continue;
+                            }
+                            while (t > 0 && bestDist[t - 1] > d) {
+                                best[t] = best[t - 1];
+                                bestDist[t] = bestDist[t - 1];
+                                t--;
+                            }
+                            best[t] = other;
+                            bestDist[t] = d;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// One local search with its own copy of the tour. Position 0 is the tool
+// position, chains are at positions 1..m.
+class TourSearch
+{
+public:
+    const QVector<ChainEnds> *ends;
+    const QVector<int> *neighbours;
+    const MachineCost *machine;
+    const QElapsedTimer *timer;
+    qint64 budgetMs;
+    bool fixedFirst;
+    quint64 seed;
+
+    QVector<int> order;
+    QVector<char> rev;
+    double cost;
+
+    void run();
+
+private:
+    QVector<int> pos;
+    int m;
+    int checks;
+
+    double entryX(int k) const
+    {
+        const ChainEnds & e = (*ends)[order[k]];
+        return rev[k] ? e.ex : e.sx;
+    }
+
+    double entryY(int k) const
+    {
+        const ChainEnds & e = (*ends)[order[k]];
+        return rev[k] ? e.ey : e.sy;
+    }
+
+    double exitX(int k) const
+    {
+        const ChainEnds & e = (*ends)[order[k]];
+        return rev[k] ? e.sx : e.ex;
+    }
+
+    double exitY(int k) const
+    {
+        const ChainEnds & e = (*ends)[order[k]];
+        return rev[k] ? e.sy : e.ey;
+    }
+
+    // Machine time of rapid move
+    double rapid(double ax, double ay, double bx, double by) const
+    {
+        return machine->moveTime((qint64) (bx - ax), (qint64) (by - ay));
+    }
+
+    // Rapid from position a to position b
+    double link(int a, int b) const
+    {
+        if (b > m) {
+            return 0;
+        }
+        return rapid(exitX(a), exitY(a), entryX(b), entryY(b));
+    }
+
+    bool timeout();
+    double totalCost() const;
+    void updatePos(int from, int to);
+    bool tryTwoOpt(int i, int j);
+    bool tryOrOpt(int i, int len, int p);
+    bool localSearch();
+    void perturb();
+    quint64 random();
+};
+
+bool TourSearch::timeout()
+{
+    return timer->elapsed() >= budgetMs;
+}
+
+double TourSearch::totalCost() const
+{
+    double res = 0;
+    for (int k = 0; k < m; k++) {
+        res += link(k, k + 1);
+    }
+    return res;
+}
+
+void TourSearch::updatePos(int from, int to)
+{
+    for (int k = from; k <= to; k++) {
+        pos[order[k]] = k;
+    }
+}
+
+quint64 TourSearch::random()
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+}
+
+// Reverse chains at positions i..j
+bool TourSearch::tryTwoOpt(int i, int j)
+{
+    if (i > j || i < (fixedFirst ? 2 : 1)) {
+        return false;
+    }
+    double old = link(i - 1, i) + link(j, j + 1);
+    double now = rapid(exitX(i - 1), exitY(i - 1), exitX(j), exitY(j));
+    if (j < m) {
+        now += rapid(entryX(i), entryY(i), entryX(j + 1), entryY(j + 1));
+    }
+    if (now > old - MIN_GAIN) {
+        return false;
+    }
+
+    for (int a = i, b = j; a <= b; a++, b--) {
+        int o = order[a];
+        char r = rev[a];
+        order[a] = order[b];
+        rev[a] = !rev[b];
+        order[b] = o;
+        rev[b] = !r;
+    }
+    updatePos(i, j);
+    cost += now - old;
+    return true;
+}
+
+// Move len chains starting at position i after position p, forward or
+// reversed whichever is better
+bool TourSearch::tryOrOpt(int i, int len, int p)
+{
+    int last = i + len - 1;
+    int lo = (fixedFirst ? 2 : 1);
+    if (i < lo || last > m || p < lo - 1 || p > m ||
+        (p >= i - 1 && p <= last)) {
+        return false;
+    }
+
+    double gain = link(i - 1, i) + link(last, last + 1);
+    if (last < m) {
+        gain -= rapid(exitX(i - 1), exitY(i - 1), entryX(last + 1),
+                     entryY(last + 1));
+    }
+    double fwd = rapid(exitX(p), exitY(p), entryX(i), entryY(i));
+    double bwd = rapid(exitX(p), exitY(p), exitX(last), exitY(last));
+    double old = 0;
+    if (p < m) {
+        fwd += rapid(exitX(last), exitY(last), entryX(p + 1), entryY(p + 1));
+        bwd += rapid(entryX(i), entryY(i), entryX(p + 1), entryY(p + 1));
+        old = link(p, p + 1);
+    }
+    bool reverse = (bwd < fwd);
+    double delta = (reverse ? bwd : fwd) - old - gain;
+    if (delta > -MIN_GAIN) {
+        return false;
+    }
+
+    // Take the run out and put it back after p
+    int run[MAX_OR_OPT];
+    char runRev[MAX_OR_OPT];
+    for (int k = 0; k < len; k++) {
+        int src = (reverse ? last - k : i + k);
+        run[k] = order[src];
+        runRev[k] = (reverse ? !rev[src] : rev[src]);
+    }
+    int from;
+    int to;
+    if (p > last) {
+        for (int k = last + 1; k <= p; k++) {
+            order[k - len] = order[k];
+            rev[k - len] = rev[k];
+        }
+        from = i;
+        to = p;
+        p -= len;
+    } else {
+        for (int k = i - 1; k > p; k--) {
+            order[k + len] = order[k];
+            rev[k + len] = rev[k];
+        }
+        from = p + 1;
+        to = last;
+    }
+    for (int k = 0; k < len; k++) {
+        order[p + 1 + k] = run[k];
+        rev[p + 1 + k] = runRev[k];
+    }
+    updatePos(from, to);
+    cost += delta;
+    return true;
+}
+
+// Returns false if interrupted by timeout
+bool TourSearch::localSearch()
+{
+    const int *nb = neighbours->constData();
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (int a = 0; a < m; a++) {
+            if ((++checks & 63) == 0 && timeout()) {
+                return false;
+            }
+
+            // 2-opt which links exit of a with exit of a near chain
+            const int *cand = nb + order[a] * NEIGHBOURS;
+            for (int t = 0; t < NEIGHBOURS && cand[t] >= 0; t++) {
+                int p = pos[cand[t]];
+                if (p > a ? tryTwoOpt(a + 1, p) : tryTwoOpt(p + 1, a)) {
+                    improved = true;
+                    break;
+                }
+            }
+
+            // Or-opt of chains after a next to a near chain
+            if (a + 1 > m) {
+                continue;
+            }
+            cand = nb + order[a + 1] * NEIGHBOURS;
+            for (int len = 1; len <= MAX_OR_OPT; len++) {
+                for (int t = 0; t < NEIGHBOURS && cand[t] >= 0; t++) {
+                    int p = pos[cand[t]];
+                    if (tryOrOpt(a + 1, len, p) ||
+                        tryOrOpt(a + 1, len, p - 1)) {
+                        improved = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Double bridge: A B C D -> A C B D
+void TourSearch::perturb()
+{
+    int lo = (fixedFirst ? 2 : 1);
+    int span = m - lo + 1;
+    int cuts[3];
+    for (int k = 0; k < 3; k++) {
+        cuts[k] = lo + 1 + (int) (random() % (span - 1));
+    }
+    qSort(cuts, cuts + 3);
+    if (cuts[0] == cuts[1] || cuts[1] == cuts[2]) {
+        return;
+    }
+
+    QVector<int> o;
+    QVector<char> r;
+    o.reserve(m + 1);
+    r.reserve(m + 1);
+    for (int k = 0; k < cuts[0]; k++) {
+        o.append(order[k]);
+        r.append(rev[k]);
+    }
+    for (int k = cuts[1]; k < cuts[2]; k++) {
+        o.append(order[k]);
+        r.append(rev[k]);
+    }
+    for (int k = cuts[0]; k < cuts[1]; k++) {
+        o.append(order[k]);
+        r.append(rev[k]);
+    }
+    for (int k = cuts[2]; k <= m; k++) {
+        o.append(order[k]);
+        r.append(rev[k]);
+    }
+    order = o;
+    rev = r;
+    updatePos(0, m);
+    cost = totalCost();
+}
+
+void TourSearch::run()
+{
+    m = order.count() - 1;
+    checks = 0;
+    pos.resize(order.count());
+    updatePos(0, m);
+    cost = totalCost();
+
+    bool done = !localSearch();
+    int lo = (fixedFirst ? 2 : 1);
+    if (m - lo + 1 < 8) {
+        return;                 // too short for double bridge
+    }
+
+    QVector<int> bestOrder = order;
+    QVector<char> bestRev = rev;
+    double bestCost = cost;
+    int idle = 0;
+    while (!done && idle < IDLE_KICKS) {
+        perturb();
+        done = !localSearch();
+        if (cost < bestCost - MIN_GAIN) {
+            bestOrder = order;
+            bestRev = rev;
+            bestCost = cost;
+            idle = 0;
+        } else {
+            idle++;
+            order = bestOrder;
+            rev = bestRev;
+            cost = bestCost;
+            updatePos(0, m);
+        }
+    }
+    order = bestOrder;
+    rev = bestRev;
+    cost = bestCost;
+}
+
+static void runSearch(TourSearch & search)
+{
+    search.run();
+}
+
+ChainOptimizer::ChainOptimizer(const SegmentStore & segs,
+                               const MachineCost & machine)
+:  segs(segs), machine(machine), timeBefore(0), timeAfter(0)
+{
+}
+
+double ChainOptimizer::before() const
+{
+    return timeBefore;
+}
+
+double ChainOptimizer::after() const
+{
+    return timeAfter;
+}
+
+double ChainOptimizer::rapidDistance(const SegmentStore & segs,
+                                     const LayerPlan & plan, qint64 x,
+                                     qint64 y)
+{
+    double res = 0;
+    for (int i = 0; i < plan.steps.count(); i++) {
+        int seg = LayerPlan::segment(plan.steps[i]);
+        bool reversed = LayerPlan::isReversed(plan.steps[i]);
+        qint64 sx = reversed ? segs.x2[seg] : segs.x1[seg];
+        qint64 sy = reversed ? segs.y2[seg] : segs.y1[seg];
+        res += dist(x, y, sx, sy);
+        x = reversed ? segs.x1[seg] : segs.x2[seg];
+        y = reversed ? segs.y1[seg] : segs.y2[seg];
+    }
+    return res;
+}
+
+double ChainOptimizer::rapidTime(const LayerPlan & plan, qint64 x,
+                                 qint64 y) const
+{
+    double res = 0;
+    for (int i = 0; i < plan.steps.count(); i++) {
+        int seg = LayerPlan::segment(plan.steps[i]);
+        bool reversed = LayerPlan::isReversed(plan.steps[i]);
+        qint64 sx = reversed ? segs.x2[seg] : segs.x1[seg];
+        qint64 sy = reversed ? segs.y2[seg] : segs.y1[seg];
+        res += machine.moveTime(sx - x, sy - y);
+        x = reversed ? segs.x1[seg] : segs.x2[seg];
+        y = reversed ? segs.y1[seg] : segs.y2[seg];
+    }
+    return res;
+}
+
+void ChainOptimizer::optimize(qint64 x, qint64 y, bool fixedFirst,
+                              int budgetMs, LayerPlan & plan)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    timeBefore = rapidTime(plan, x, y);
+    timeAfter = timeBefore;
+    int chains = plan.chainStarts.count();
+    if (chains < 2) {
+        return;
+    }
+
+    // Chain end points, chain 0 is the tool position
+    QVector<ChainEnds> ends(chains + 1);
+    ends[0].sx = ends[0].ex = x;
+    ends[0].sy = ends[0].ey = y;
+    for (int c = 0; c < chains; c++) {
+        int first = plan.steps[plan.chainStarts[c]];
+        int last = plan.steps[(c + 1 < chains ? plan.chainStarts[c + 1] :
+                               plan.steps.count()) - 1];
+        int fs = LayerPlan::segment(first);
+        int ls = LayerPlan::segment(last);
+        bool fr = LayerPlan::isReversed(first);
+        bool lr = LayerPlan::isReversed(last);
+        ends[c + 1].sx = fr ? segs.x2[fs] : segs.x1[fs];
+        ends[c + 1].sy = fr ? segs.y2[fs] : segs.y1[fs];
+        ends[c + 1].ex = lr ? segs.x1[ls] : segs.x2[ls];
+        ends[c + 1].ey = lr ? segs.y1[ls] : segs.y2[ls];
+    }
+    QVector<int> neighbours;
+    nearestChains(ends, neighbours);
+
+    int threads = qMax(QThread::idealThreadCount(), 1);
+    QVector<TourSearch> searches(threads);
+    for (int t = 0; t < threads; t++) {
+        TourSearch & s = searches[t];
+        s.ends = &ends;
+        s.neighbours = &neighbours;
+        s.machine = &machine;
+        s.timer = &timer;
+        s.budgetMs = budgetMs;
+        s.fixedFirst = fixedFirst;
+        s.seed = t + 1;
+        s.order.resize(chains + 1);
+        s.rev.fill(0, chains + 1);
+        for (int c = 0; c <= chains; c++) {
+            s.order[c] = c;
+        }
+    }
+    QtConcurrent::blockingMap(searches, runSearch);
+
+    int best = 0;
+    for (int t = 1; t < threads; t++) {
+        if (searches[t].cost < searches[best].cost) {
+            best = t;
+        }
+    }
+
+    // Rebuild steps in the new chain order, reversed chain has its steps
+    // in reverse order and each of them reversed
+    const TourSearch & s = searches[best];
+    LayerPlan res;
+    res.steps.reserve(plan.steps.count());
+    qint64 cx = x;
+    qint64 cy = y;
+    for (int k = 1; k <= chains; k++) {
+        int c = s.order[k] - 1;
+        int from = plan.chainStarts[c];
+        int to = (c + 1 < chains ? plan.chainStarts[c + 1] :
+                  plan.steps.count());
+        res.chainStarts.append(res.steps.count());
+        const ChainEnds & e = ends[c + 1];
+        qint64 sx = (qint64) (s.rev[k] ? e.ex : e.sx);
+        qint64 sy = (qint64) (s.rev[k] ? e.ey : e.sy);
+        if (sx != cx || sy != cy) {
+            res.rapids++;
+        }
+        for (int i = from; i < to; i++) {
+            res.steps.append(s.rev[k] ? -1 - plan.steps[from + to - 1 - i] :
+                             plan.steps[i]);
+        }
+        cx = (qint64) (s.rev[k] ? e.sx : e.ex);
+        cy = (qint64) (s.rev[k] ? e.sy : e.ey);
+    }
+
+    timeAfter = rapidTime(res, x, y);
+    if (timeAfter < timeBefore) {
+        plan = res;
+    } else {
+        timeAfter = timeBefore;
+    }
+}
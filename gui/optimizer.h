@@ -0,0 +1,46 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "machinecost.h"
+#include "planner.h"
+
+// Shortens machine time of rapid moves of a layer plan by reordering and
+// reversing its chains.
+//
+// Chains are nodes of an open tour starting at the tool position. Local
+// search applies 2-opt (reverse run of chains) and Or-opt (move up to three
+// chains elsewhere, possibly reversed) with candidates taken from the
+// nearest chains. After a local optimum the tour is perturbed (double
+// bridge) and searched again. Independent searches run on all cores until
+// perturbations stop improving the tour or the wall clock budget runs out,
+// the best tour wins.
+class ChainOptimizer
+{
+public:
+    ChainOptimizer(const SegmentStore & segs, const MachineCost & machine);
+
+    // Optimize plan made from tool position x, y. With fixedFirst the
+    // first chain stays first (LayerPlanner firstSegment).
+    void optimize(qint64 x, qint64 y, bool fixedFirst, int budgetMs,
+                  LayerPlan & plan);
+
+    // Rapid move time (microseconds) of plan before and after last
+    // optimize()
+    double before() const;
+    double after() const;
+
+    // Machine time of rapid moves of plan starting at x, y
+    double rapidTime(const LayerPlan & plan, qint64 x, qint64 y) const;
+
+    // Sum of rapid move lengths of plan starting at x, y
+    static double rapidDistance(const SegmentStore & segs,
+                                const LayerPlan & plan, qint64 x, qint64 y);
+
+private:
+    const SegmentStore & segs;
+    const MachineCost & machine;
+    double timeBefore;
+    double timeAfter;
+};
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,154 @@
+#include "planner.h"
+
+LayerPlanner::LayerPlanner(const SegmentStore & segs)
+:  segs(segs)
+{
+    // Table at most half full
+    int n = segs.count();
+    int bits = 4;
+    while ((1 << bits) < 4 * n) {
+        bits++;
+    }
+    slotShift = 64 - bits;
+    slotKeys.fill(0, 1 << bits);
+    slotHeads.fill(-1, 1 << bits);
+
+    cut.resize(n);
+    pointNext.resize(2 * n);
+    for (int i = 2 * n - 1; i >= 0; i--) {
+        int seg = i >> 1;
+        qint64 x = (i & 1) ? segs.x2[seg] : segs.x1[seg];
+        qint64 y = (i & 1) ? segs.y2[seg] : segs.y1[seg];
+        quint64 key = pointKey(x, y);
+        int slot = findSlot(key);
+        slotKeys[slot] = key;
+        pointNext[i] = slotHeads[slot];
+        slotHeads[slot] = i;
+    }
+}
+
+quint64 LayerPlanner::pointKey(qint64 x, qint64 y)
+{
+    return ((quint64) (quint32) x << 32) | (quint32) y;
+}
+
+// Slot with the key or empty slot where it belongs
+int LayerPlanner::findSlot(quint64 key) const
+{
+    int mask = slotKeys.count() - 1;
+    int slot = (int) ((key * 0x9e3779b97f4a7c15ULL) >> slotShift);
+    while (slotHeads[slot] >= 0 && slotKeys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Remaining end point exactly at x, y or -1. Ties are broken the same way
+// as in SegmentIndex::nearest(): higher segment, then segment start.
+int LayerPlanner::connected(qint64 x, qint64 y) const
+{
+    int best = -1;
+    for (int p = slotHeads[findSlot(pointKey(x, y))]; p >= 0;
+         p = pointNext[p]) {
+        if (cut.isMarked(p >> 1)) {
+            continue;
+        }
+        if (best < 0 || (p >> 1) > (best >> 1) ||
+            ((p >> 1) == (best >> 1) && (p & 1) == 0)) {
+            best = p;
+        }
+    }
+    return best;
+}
+
+void LayerPlanner::plan(qint64 x, qint64 y, bool firstSegment,
+                        LayerPlan & plan)
+{
+    plan.clear();
+    int n = segs.count();
+    plan.steps.reserve(n);
+    cut.clear();
+    index.build(segs);
+
+    while (cut.count() < n) {
+        int seg;
+        bool reversed = false;
+        int point = (firstSegment ? -1 : connected(x, y));
+        if (point >= 0) {
+            seg = point >> 1;
+            reversed = (point & 1);
+        } else if (firstSegment) {
+            seg = 0;
+            qint64 w = segs.x1[0] - x;
+            qint64 h = segs.y1[0] - y;
+            qint64 dist1 = w * w + h * h;
+            w = segs.x2[0] - x;
+            h = segs.y2[0] - y;
+            qint64 dist2 = w * w + h * h;
+            reversed = (dist2 < dist1);
+        } else {
+            seg = index.nearest(x, y, reversed);
+        }
+        firstSegment = false;
+        cut.mark(seg);
+        index.remove(seg);
+
+        qint64 sx = reversed ? segs.x2[seg] : segs.x1[seg];
+        qint64 sy = reversed ? segs.y2[seg] : segs.y1[seg];
+        if (point < 0 || plan.steps.isEmpty()) {
+            plan.chainStarts.append(plan.steps.count());
+            if (sx != x || sy != y) {
+                plan.rapids++;
+            }
+        }
+        plan.steps.append(reversed ? -1 - seg : seg);
+        x = reversed ? segs.x1[seg] : segs.x2[seg];
+        y = reversed ? segs.y1[seg] : segs.y2[seg];
+    }
+}
+
+bool LayerPlan::ends(const SegmentStore & segs, qint64 & sx, qint64 & sy,
+                     qint64 & ex, qint64 & ey) const
+{
+    if (steps.isEmpty()) {
+        return false;
+    }
+    int first = steps.first();
+    int last = steps.last();
+    int fs = segment(first);
+    int ls = segment(last);
+    sx = isReversed(first) ? segs.x2[fs] : segs.x1[fs];
+    sy = isReversed(first) ? segs.y2[fs] : segs.y1[fs];
+    ex = isReversed(last) ? segs.x1[ls] : segs.x2[ls];
+    ey = isReversed(last) ? segs.y1[ls] : segs.y2[ls];
+    return true;
+}
+
+bool LayerPlan::isEndNearer(const SegmentStore & segs, qint64 x,
+                            qint64 y) const
+{
+    qint64 sx;
+    qint64 sy;
+    qint64 ex;
+    qint64 ey;
+    return ends(segs, sx, sy, ex, ey) && isEndNearer(sx, sy, ex, ey, x, y);
+}
+
+void LayerPlan::reverse()
+{
+    int n = steps.count();
+    for (int i = 0, j = n - 1; i <= j; i++, j--) {
+        int step = steps[i];
+        steps[i] = -1 - steps[j];
+        steps[j] = -1 - step;
+    }
+
+    // Chain which ended at e now starts at n - e
+    int chains = chainStarts.count();
+    QVector<int> starts(chains);
+    for (int c = 0; c < chains; c++) {
+        int end = (c + 1 < chains ? chainStarts[c + 1] : n);
+        starts[chains - 1 - c] = n - end;
+    }
+    chainStarts = starts;
+}
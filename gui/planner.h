@@ -0,0 +1,97 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <QVector>
+
+#include "segmentindex.h"
+#include "segmentstore.h"
+
+// Cutting order of one layer.
+//
+// Step is segment index, or -1 - index if the segment is cut from its end
+// to its start. Chain is a run of steps where each one starts at the end
+// of the previous one, there is a rapid move before a chain unless it
+// starts right where the tool is.
+struct LayerPlan
+{
+    QVector<int> steps;
+    QVector<int> chainStarts;   // first step of each chain
+    int rapids;
+
+    LayerPlan()
+    :  rapids(0)
+    {
+    }
+
+    void clear()
+    {
+        steps.clear();
+        chainStarts.clear();
+        rapids = 0;
+    }
+
+    // First and last point of the plan, false if it is empty
+    bool ends(const SegmentStore & segs, qint64 & sx, qint64 & sy,
+              qint64 & ex, qint64 & ey) const;
+
+    // Replay from x, y should go backwards because the plan ends nearer
+    // then it starts
+    bool isEndNearer(const SegmentStore & segs, qint64 x, qint64 y) const;
+
+    static bool isEndNearer(qint64 sx, qint64 sy, qint64 ex, qint64 ey,
+                            qint64 x, qint64 y)
+    {
+        return (ex - x) * (ex - x) + (ey - y) * (ey - y) <
+            (sx - x) * (sx - x) + (sy - y) * (sy - y);
+    }
+
+    // Cut the same segments backwards, chains keep their rapid moves
+    // between them
+    void reverse();
+
+    static int segment(int step)
+    {
+        return (step < 0 ? -1 - step : step);
+    }
+
+    static bool isReversed(int step)
+    {
+        return step < 0;
+    }
+};
+
+// Plans cutting order of a layer.
+//
+// End points are hashed by coordinates once per layer, so that connected
+// segments are followed directly. Nearest remaining end point is searched
+// in SegmentIndex only at the end of a chain. Both pick the same segment
+// the plain nearest neighbour search would (see SegmentIndex::nearest()).
+class LayerPlanner
+{
+public:
+    LayerPlanner(const SegmentStore & segs);
+
+    // Plan from tool position x, y. If firstSegment is set the plan starts
+    // with segment 0. Can be called again, e.g. from another position.
+    void plan(qint64 x, qint64 y, bool firstSegment, LayerPlan & plan);
+
+private:
+    const SegmentStore & segs;
+
+    // Open addressing hash of end point coordinates, slot holds the first
+    // end point at the coordinates (-1 for empty slot) and pointNext links
+    // the others
+    QVector<quint64> slotKeys;
+    QVector<int> slotHeads;
+    int slotShift;
+    QVector<int> pointNext;
+
+    SegmentMarks cut;           // segments already in the plan
+    SegmentIndex index;
+
+    static quint64 pointKey(qint64 x, qint64 y);
+    int findSlot(quint64 key) const;
+    int connected(qint64 x, qint64 y) const;
+};
+
+#endif // PLANNER_H
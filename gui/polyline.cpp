@@ -0,0 +1,188 @@
+#include "polyline.h"
+
+// Points are flushed at this polyline length to bound memory, the cut
+// point is kept so nothing changes on the output but a vertex
+#define MAX_POLYLINE_POINTS 65536
+
+PolylineSimplifier::PolylineSimplifier(SvgSegmentSink * sink,
+                                       qint64 tolerance)
+:  sink(sink), tolerance(tolerance < 0 ? 0 : tolerance), input(0), output(0),
+   stopped(false)
+{
+}
+
+int PolylineSimplifier::inputCount() const
+{
+    return input;
+}
+
+int PolylineSimplifier::outputCount() const
+{
+    return output;
+}
+
+int PolylineSimplifier::removedCount() const
+{
+    return input - output;
+}
+
+bool PolylineSimplifier::addSegment(qint64 x1, qint64 y1, qint64 x2,
+                                    qint64 y2)
+{
+    if (stopped) {
+        return false;
+    }
+    input++;
+
+    int n = xs.count();
+    if (n > 0 && (xs[n - 1] != x1 || ys[n - 1] != y1 ||
+                  n >= MAX_POLYLINE_POINTS)) {
+        bool connected = (xs[n - 1] == x1 && ys[n - 1] == y1);
+        if (!flush()) {
+            return false;
+        }
+        if (connected) {
+            xs.append(x1);      // continue from the cut point
+            ys.append(y1);
+        }
+    }
+    if (xs.isEmpty()) {
+        xs.append(x1);
+        ys.append(y1);
+    }
+    xs.append(x2);
+    ys.append(y2);
+    return true;
+}
+
+bool PolylineSimplifier::finish()
+{
+    if (stopped) {
+        return false;
+    }
+    return flush();
+}
+
+// Squared distance of point p from segment a-b
+double PolylineSimplifier::distance2(int a, int b, int p) const
+{
+    double dx = xs[b] - xs[a];
+    double dy = ys[b] - ys[a];
+    double px = xs[p] - xs[a];
+    double py = ys[p] - ys[a];
+    double len2 = dx * dx + dy * dy;
+    double dot = dx * px + dy * py;
+    if (dot <= 0 || len2 == 0) {
+        return px * px + py * py;
+    }
+    if (dot >= len2) {
+        return (px - dx) * (px - dx) + (py - dy) * (py - dy);
+    }
+    double cross = dx * py - dy * px;
+    return cross * cross / len2;
+}
+
+// True if segment b-c continues exactly in direction of a-b. Zero length
+// segments continue any direction.
+bool PolylineSimplifier::isStraight(int a, int b, int c) const
+{
+    qint64 dx1 = xs[b] - xs[a];
+    qint64 dy1 = ys[b] - ys[a];
+    qint64 dx2 = xs[c] - xs[b];
+    qint64 dy2 = ys[c] - ys[b];
+    if ((dx1 == 0 && dy1 == 0) || (dx2 == 0 && dy2 == 0)) {
+        return true;
+    }
+
+    // Products of 32 bit differences fit to 64 bits, keep anything larger
+    const qint64 lim = 0x7fffffffLL;
+    if (qAbs(dx1) > lim || qAbs(dy1) > lim || qAbs(dx2) > lim ||
+        qAbs(dy2) > lim) {
+        return false;
+    }
+    return dx1 * dy2 == dx2 * dy1 && dx1 * dx2 + dy1 * dy2 > 0;
+}
+
+// Keep only points where the direction changes
+void PolylineSimplifier::mergeCollinear()
+{
+    int n = xs.count();
+    int anchor = 0;             // first point of current straight run
+    for (int i = 1; i < n - 1; i++) {
+        if (isStraight(anchor, i, i + 1)) {
+            continue;
+        }
+        keep[i] = true;
+        anchor = i;
+    }
+}
+
+// Douglas-Peucker without recursion, long polylines would overflow the stack
+void PolylineSimplifier::simplify()
+{
+    stack.clear();
+    stack.append(0);
+    stack.append(xs.count() - 1);
+    while (!stack.isEmpty()) {
+        int b = stack.last();
+        stack.removeLast();
+        int a = stack.last();
+        stack.removeLast();
+
+        // Farthest point from the chord
+        int split = -1;
+        double maxDist = (double) tolerance * tolerance;
+        for (int i = a + 1; i < b; i++) {
+            double dist = distance2(a, b, i);
+            if (dist > maxDist) {
+                maxDist = dist;
+                split = i;
+            }
+        }
+        if (split < 0) {
+            continue;
+        }
+        keep[split] = true;
+        stack.append(a);
+        stack.append(split);
+        stack.append(split);
+        stack.append(b);
+    }
+}
+
+// Simplify pending polyline and send its segments to the sink
+bool PolylineSimplifier::flush()
+{
+    int n = xs.count();
+    if (n < 2) {
+        xs.clear();
+        ys.clear();
+        return true;
+    }
+
+    keep.fill(false, n);
+    keep[0] = true;
+    keep[n - 1] = true;
+
+    if (tolerance == 0) {
+        mergeCollinear();
+    } else {
+        simplify();
+    }
+
+    int prev = 0;
+    for (int i = 1; i < n; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        output++;
+        if (!sink->addSegment(xs[prev], ys[prev], xs[i], ys[i])) {
+            stopped = true;
+            break;
+        }
+        prev = i;
+    }
+    xs.clear();
+    ys.clear();
+    return !stopped;
+}
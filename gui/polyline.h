@@ -0,0 +1,46 @@
+#ifndef POLYLINE_H
+#define POLYLINE_H
+
+#include <QVector>
+
+#include "svgreader.h"
+
+// Joins connected segments into polylines and simplifies them before they
+// reach the next sink.
+//
+// A segment continues the current polyline if it starts where the previous
+// one ended. Each polyline is simplified with Douglas-Peucker: a point is
+// dropped if the path between its neighbours stays within tolerance of the
+// straight line. Tolerance 0 merges only exactly collinear points. Call
+// finish() after the last segment to flush the pending polyline.
+class PolylineSimplifier : public SvgSegmentSink
+{
+public:
+    PolylineSimplifier(SvgSegmentSink *sink, qint64 tolerance);
+
+    bool addSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2);
+    bool finish();
+
+    int inputCount() const;
+    int outputCount() const;
+    int removedCount() const;
+
+private:
+    SvgSegmentSink *sink;
+    qint64 tolerance;
+    int input;
+    int output;
+    bool stopped;
+    QVector<qint64> xs;
+    QVector<qint64> ys;
+    QVector<bool> keep;
+    QVector<int> stack;
+
+    bool flush();
+    double distance2(int a, int b, int p) const;
+    bool isStraight(int a, int b, int c) const;
+    void mergeCollinear();
+    void simplify();
+};
+
+#endif // POLYLINE_H
@@ -0,0 +1,240 @@
+#include "segmentindex.h"
+
+#include <math.h>
+
+// Candidate end point is better then the best one so far
+static inline bool isBetter(qint64 dist, int point, qint64 bestDist,
+                            int bestPoint)
+{
+    if (dist != bestDist) {
+        return dist < bestDist;
+    }
+    int seg = point >> 1;
+    int bestSeg = bestPoint >> 1;
+    if (seg != bestSeg) {
+        return seg > bestSeg;
+    }
+    return (point & 1) == 0;
+}
+
+SegmentIndex::SegmentIndex()
+:  segs(NULL), minX(0), minY(0), cell(1), cols(0), rows(0)
+{
+}
+
+int SegmentIndex::count() const
+{
+    return left.count();
+}
+
+bool SegmentIndex::contains(int seg) const
+{
+    return leftPos[seg] >= 0;
+}
+
+int SegmentIndex::cellOf(qint64 x, qint64 y) const
+{
+    qint64 col = (x - minX) / cell;
+    qint64 row = (y - minY) / cell;
+    col = qBound((qint64) 0, col, (qint64) cols - 1);
+    row = qBound((qint64) 0, row, (qint64) rows - 1);
+    return (int) (row * cols + col);
+}
+
+void SegmentIndex::build(const SegmentStore & segs)
+{
+    this->segs = &segs;
+    int n = segs.count();
+    const qint32 *x1 = segs.x1.constData();
+    const qint32 *y1 = segs.y1.constData();
+    const qint32 *x2 = segs.x2.constData();
+    const qint32 *y2 = segs.y2.constData();
+
+    left.resize(n);
+    leftPos.resize(n);
+    for (int i = 0; i < n; i++) {
+        left[i] = i;
+        leftPos[i] = i;
+    }
+
+    qint64 maxX = 0;
+    qint64 maxY = 0;
+    minX = 0;
+    minY = 0;
+    for (int i = 0; i < n; i++) {
+        qint64 ax = qMin(x1[i], x2[i]);
+        qint64 bx = qMax(x1[i], x2[i]);
+        qint64 ay = qMin(y1[i], y2[i]);
+        qint64 by = qMax(y1[i], y2[i]);
+        if (i == 0) {
+            minX = ax;
+            maxX = bx;
+            minY = ay;
+            maxY = by;
+        }
+        minX = qMin(minX, ax);
+        maxX = qMax(maxX, bx);
+        minY = qMin(minY, ay);
+        maxY = qMax(maxY, by);
+    }
+
+    // About one cell per segment, grown for long thin layers so that the
+    // grid stays small
+    qint64 w = maxX - minX + 1;
+    qint64 h = maxY - minY + 1;
+    cell = (qint64) ceil(sqrt((double) w * h / qMax(n, 1)));
+    cell = qMax(cell, (qint64) 1);
+    for (;;) {
+        qint64 c = w / cell + 1;
+        qint64 r = h / cell + 1;
+        if (c * r <= 4 * (qint64) n + 16) {
+            cols = (int) c;
+            rows = (int) r;
+            break;
+        }
+        cell *= 2;
+    }
+
+    // Counting sort of end points by cell
+    int cells = cols * rows;
+    cellStart.fill(0, cells + 1);
+    cellCount.fill(0, cells);
+    for (int i = 0; i < n; i++) {
+        cellCount[cellOf(x1[i], y1[i])]++;
+        cellCount[cellOf(x2[i], y2[i])]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        cellStart[c + 1] = cellStart[c] + cellCount[c];
+        cellCount[c] = 0;
+    }
+    entries.resize(2 * n);
+    entryPos.resize(2 * n);
+    for (int i = 0; i < 2 * n; i++) {
+        int c = (i & 1) ? cellOf(x2[i >> 1], y2[i >> 1]) :
+            cellOf(x1[i >> 1], y1[i >> 1]);
+        int pos = cellStart[c] + cellCount[c]++;
+        entries[pos] = i;
+        entryPos[i] = pos;
+    }
+}
+
+// Swap end point with the last remaining one of its cell
+void SegmentIndex::removeEntry(int point)
+{
+    int seg = point >> 1;
+    qint64 x = (point & 1) ? segs->x2[seg] : segs->x1[seg];
+    qint64 y = (point & 1) ? segs->y2[seg] : segs->y1[seg];
+    int c = cellOf(x, y);
+    int last = cellStart[c] + --cellCount[c];
+    int pos = entryPos[point];
+    int other = entries[last];
+    entries[pos] = other;
+    entryPos[other] = pos;
+    entries[last] = point;
+    entryPos[point] = last;
+}
+
+void SegmentIndex::remove(int seg)
+{
+    int pos = leftPos[seg];
+    if (pos < 0) {
+        return;
+    }
+    int other = left.last();
+    left[pos] = other;
+    leftPos[other] = pos;
+    left.removeLast();
+    leftPos[seg] = -1;
+
+    removeEntry(2 * seg);
+    removeEntry(2 * seg + 1);
+}
+
+int SegmentIndex::nearest(qint64 x, qint64 y, bool & reversed) const
+{
+    if (left.isEmpty()) {
+        return -1;
+    }
+
+    const qint32 *x1 = segs->x1.constData();
+    const qint32 *y1 = segs->y1.constData();
+    const qint32 *x2 = segs->x2.constData();
+    const qint32 *y2 = segs->y2.constData();
+    qint64 bestDist = 0x7fffffffffffffffLL;
+    int best = -1;
+
+    // Walk rings of cells around the query. Points in ring r are at least
+    // (r - 1) cells away, so we can stop once that is more then the best
+    // distance. Give up on the grid when the walk gets longer then the
+    // list of remaining segments.
+    int c = cellOf(x, y);
+    int col = c % cols;
+    int row = c / cols;
+    int maxRing = qMax(qMax(col, cols - 1 - col), qMax(row, rows - 1 - row));
+    qint64 budget = 2 * (qint64) left.count() + 8;
+    bool done = false;
+    for (int r = 0; r <= maxRing && !done; r++) {
+        if (best >= 0) {
+            double bound = (double) (r - 1) * cell;
+            if (r > 0 && bound * bound > (double) bestDist) {
+                done = true;
+                break;
+            }
+        }
+        if (budget < 0) {
+            break;
+        }
+        int r0 = qMax(row - r, 0);
+        int r1 = qMin(row + r, rows - 1);
+        for (int j = r0; j <= r1; j++) {
+            // Whole row on top and bottom of the ring, just sides otherwise
+            bool edge = (j == row - r || j == row + r);
+            int step = (edge || r == 0 ? 1 : 2 * r);
+            for (int i = col - r; i <= col + r; i += step) {
+                if (i < 0 || i >= cols) {
+                    continue;
+                }
+                int k = j * cols + i;
+                int start = cellStart[k];
+                int end = start + cellCount[k];
+                budget -= 1 + cellCount[k];
+                for (int e = start; e < end; e++) {
+                    int point = entries[e];
+                    int seg = point >> 1;
+                    qint64 w = ((point & 1) ? x2[seg] : x1[seg]) - x;
+                    qint64 h = ((point & 1) ? y2[seg] : y1[seg]) - y;
+                    qint64 dist = w * w + h * h;
+                    if (best < 0 || isBetter(dist, point, bestDist, best)) {
+                        bestDist = dist;
+                        best = point;
+                    }
+                }
+            }
+        }
+        if (r == maxRing) {
+            done = true;
+        }
+    }
+
+    if (!done) {
+        // Linear search over remaining segments
+        bestDist = 0x7fffffffffffffffLL;
+        best = -1;
+        for (int i = 0; i < left.count(); i++) {
+            int seg = left[i];
+            for (int end = 0; end < 2; end++) {
+                int point = 2 * seg + end;
+                qint64 w = (end ? x2[seg] : x1[seg]) - x;
+                qint64 h = (end ? y2[seg] : y1[seg]) - y;
+                qint64 dist = w * w + h * h;
+                if (best < 0 || isBetter(dist, point, bestDist, best)) {
+                    bestDist = dist;
+                    best = point;
+                }
+            }
+        }
+    }
+
+    reversed = (best & 1);
+    return best >> 1;
+}
@@ -0,0 +1,51 @@
+#ifndef SEGMENTINDEX_H
+#define SEGMENTINDEX_H
+
+#include <QVector>
+
+#include "segmentstore.h"
+
+// Uniform grid over segment end points for nearest end point queries.
+//
+// Grid has about one cell per segment. Removed segments are swapped out of
+// their cells in O(1), so queries only look at segments that are left.
+// When few segments are left far apart, queries scan the list of remaining
+// segments instead of walking empty cells.
+class SegmentIndex
+{
+public:
+    SegmentIndex();
+
+    // Index all segments of segs, the store must not change while the
+    // index is used
+    void build(const SegmentStore & segs);
+
+    int count() const;
+    bool contains(int seg) const;
+    void remove(int seg);
+
+    // Nearest end point of remaining segments to x, y. Returns segment
+    // index or -1 if none is left, reversed is set if the nearest point is
+    // the segment end. Ties go to the higher segment index and to the
+    // segment start, same as the linear search in millShape() did.
+    int nearest(qint64 x, qint64 y, bool & reversed) const;
+
+private:
+    const SegmentStore *segs;
+    qint64 minX;
+    qint64 minY;
+    qint64 cell;
+    int cols;
+    int rows;
+    QVector<int> cellStart;     // first entry of cell
+    QVector<int> cellCount;     // remaining entries of cell
+    QVector<int> entries;       // end points (segment * 2 + end) by cell
+    QVector<int> entryPos;      // position of end point in entries
+    QVector<int> left;          // remaining segments
+    QVector<int> leftPos;       // position of segment in left, -1 if removed
+
+    int cellOf(qint64 x, qint64 y) const;
+    void removeEntry(int point);
+};
+
+#endif // SEGMENTINDEX_H
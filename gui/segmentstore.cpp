@@ -0,0 +1,54 @@
+#include "segmentstore.h"
+
+SegmentStore::SegmentStore()
+{
+}
+
+void SegmentStore::clear()
+{
+    x1.clear();
+    y1.clear();
+    x2.clear();
+    y2.clear();
+}
+
+void SegmentStore::reserve(int n)
+{
+    x1.reserve(n);
+    y1.reserve(n);
+    x2.reserve(n);
+    y2.reserve(n);
+}
+
+bool SegmentStore::append(qint64 ax, qint64 ay, qint64 bx, qint64 by)
+{
+    if (!fitsCoord(ax) || !fitsCoord(ay) || !fitsCoord(bx) || !fitsCoord(by)) {
+        return false;
+    }
+    x1.append((qint32) ax);
+    y1.append((qint32) ay);
+    x2.append((qint32) bx);
+    y2.append((qint32) by);
+    return true;
+}
+
+SegmentMarks::SegmentMarks()
+:  epoch(1), marked(0)
+{
+}
+
+void SegmentMarks::resize(int count)
+{
+    stamps.fill(0, count);
+    epoch = 1;
+    marked = 0;
+}
+
+void SegmentMarks::clear()
+{
+    if (++epoch == 0) {
+        stamps.fill(0);
+        epoch = 1;
+    }
+    marked = 0;
+}
@@ -0,0 +1,114 @@
+#ifndef SEGMENTSTORE_H
+#define SEGMENTSTORE_H
+
+#include <QVector>
+
+// Bounding box of segments. Max starts at 0 so that bounds of all layers
+// include the origin (same as the original min/max tracking in loadSvg).
+struct SegmentBounds
+{
+    qint64 minX;
+    qint64 maxX;
+    qint64 minY;
+    qint64 maxY;
+
+    SegmentBounds()
+    :  minX(0x7fffffffffffffffLL), maxX(0), minY(0x7fffffffffffffffLL),
+       maxY(0)
+    {
+    }
+
+    void add(qint64 x, qint64 y)
+    {
+        minX = (x < minX ? x : minX);
+        maxX = (x > maxX ? x : maxX);
+        minY = (y < minY ? y : minY);
+        maxY = (y > maxY ? y : maxY);
+    }
+
+    void unite(const SegmentBounds & b)
+    {
+        minX = (b.minX < minX ? b.minX : minX);
+        maxX = (b.maxX > maxX ? b.maxX : maxX);
+        minY = (b.minY < minY ? b.minY : minY);
+        maxY = (b.maxY > maxY ? b.maxY : maxY);
+    }
+};
+
+// Line segments of one layer stored as structure of arrays.
+//
+// Coordinates are svg pixels * 1000 (same as loadSvg), 32 bits are enough
+// for +-2147483 svg pixels which is far more then our board sizes. Arrays
+// grow on demand, there is no limit on segment count.
+class SegmentStore
+{
+public:
+    QVector<qint32> x1;
+    QVector<qint32> y1;
+    QVector<qint32> x2;
+    QVector<qint32> y2;
+
+    SegmentStore();
+
+    int count() const
+    {
+        return x1.count();
+    }
+
+    bool isEmpty() const
+    {
+        return x1.isEmpty();
+    }
+
+    void clear();
+    void reserve(int n);
+
+    // Returns false if coordinates do not fit in 32 bits
+    bool append(qint64 ax, qint64 ay, qint64 bx, qint64 by);
+
+    static bool fitsCoord(qint64 val)
+    {
+        return val >= -0x7fffffffLL && val <= 0x7fffffffLL;
+    }
+};
+
+// Set of marked segments (e.g. already cut ones) with O(1) clear.
+//
+// Segment is marked when its stamp equals the current epoch, so clear()
+// just starts a new epoch. Stamps are only rewritten when the epoch
+// counter wraps around.
+class SegmentMarks
+{
+public:
+    SegmentMarks();
+
+    // Size for count segments, all unmarked
+    void resize(int count);
+    void clear();
+
+    // Number of marked segments
+    int count() const
+    {
+        return marked;
+    }
+
+    bool isMarked(int seg) const
+    {
+        return stamps[seg] == epoch;
+    }
+
+    void mark(int seg)
+    {
+        if (stamps[seg] != epoch) {
+            stamps[seg] = epoch;
+            marked++;
+        }
+    }
+
+private:
+    QVector<quint32> stamps;
+    quint32 epoch;
+    int marked;
+};
+
+#endif // SEGMENTSTORE_H
@@ -0,0 +1,267 @@
+#include "segmenttransform.h"
+
+// Vector kernels are compiled with target attributes and selected at
+// runtime, so the binary still runs on cpus without sse4.1 (and anything
+// that is not x86 uses the scalar loops).
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define SEGMENT_SIMD
+#include <immintrin.h>
+#endif
+
+// Max magnitude of transform offset, keeps map() in 64 bits
+#define MAX_TRANSFORM_OFFSET (1LL << 62)
+
+typedef void (*BoundsKernel) (const qint32 *p, int n, qint32 & lo,
+                              qint32 & hi);
+typedef void (*TransformKernel) (qint32 *p, int n, qint32 scale,
+                                 qint32 offset, qint32 & lo, qint32 & hi);
+
+static void boundsScalar(const qint32 *p, int n, qint32 & lo, qint32 & hi)
+{
+    qint32 l = lo;
+    qint32 h = hi;
+    for (int i = 0; i < n; i++) {
+        l = (p[i] < l ? p[i] : l);
+        h = (p[i] > h ? p[i] : h);
+    }
+    lo = l;
+    hi = h;
+}
+
+// Multiply and add wrap around in unsigned, results are exact as long as
+// they fit in 32 bits which transformSegments() checks up front
+static void transformScalar(qint32 *p, int n, qint32 scale, qint32 offset,
+                            qint32 & lo, qint32 & hi)
+{
+    quint32 s = (quint32) scale;
+    quint32 o = (quint32) offset;
+    qint32 l = lo;
+    qint32 h = hi;
+    for (int i = 0; i < n; i++) {
+        qint32 v = (qint32) ((quint32) p[i] * s + o);
+        p[i] = v;
+        l = (v < l ? v : l);
+        h = (v > h ? v : h);
+    }
+    lo = l;
+    hi = h;
+}
+
+#ifdef SEGMENT_SIMD
+
+__attribute__ ((target("sse4.1")))
+static void reduceSse(__m128i vlo, __m128i vhi, qint32 & lo, qint32 & hi)
+{
+    vlo = _mm_min_epi32(vlo, _mm_shuffle_epi32(vlo, _MM_SHUFFLE(1, 0, 3, 2)));
+    vlo = _mm_min_epi32(vlo, _mm_shuffle_epi32(vlo, _MM_SHUFFLE(2, 3, 0, 1)));
+    vhi = _mm_max_epi32(vhi, _mm_shuffle_epi32(vhi, _MM_SHUFFLE(1, 0, 3, 2)));
+    vhi = _mm_max_epi32(vhi, _mm_shuffle_epi32(vhi, _MM_SHUFFLE(2, 3, 0, 1)));
+    lo = _mm_cvtsi128_si32(vlo);
+    hi = _mm_cvtsi128_si32(vhi);
+}
+
+__attribute__ ((target("sse4.1")))
+static void boundsSse41(const qint32 *p, int n, qint32 & lo, qint32 & hi)
+{
+    __m128i vlo = _mm_set1_epi32(lo);
+    __m128i vhi = _mm_set1_epi32(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        vlo = _mm_min_epi32(vlo, v);
+        vhi = _mm_max_epi32(vhi, v);
+    }
+    reduceSse(vlo, vhi, lo, hi);
+    boundsScalar(p + i, n - i, lo, hi);
+}
+
+__attribute__ ((target("sse4.1")))
+static void transformSse41(qint32 *p, int n, qint32 scale, qint32 offset,
+                           qint32 & lo, qint32 & hi)
+{
+    __m128i s = _mm_set1_epi32(scale);
+    __m128i o = _mm_set1_epi32(offset);
+    __m128i vlo = _mm_set1_epi32(lo);
+    __m128i vhi = _mm_set1_epi32(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        v = _mm_add_epi32(_mm_mullo_epi32(v, s), o);
+        _mm_storeu_si128((__m128i *) (p + i), v);
+        vlo = _mm_min_epi32(vlo, v);
+        vhi = _mm_max_epi32(vhi, v);
+    }
+    reduceSse(vlo, vhi, lo, hi);
+    transformScalar(p + i, n - i, scale, offset, lo, hi);
+}
+
+__attribute__ ((target("avx2")))
+static void reduceAvx2(__m256i vlo, __m256i vhi, qint32 & lo, qint32 & hi)
+{
+    __m128i l = _mm_min_epi32(_mm256_castsi256_si128(vlo),
+                              _mm256_extracti128_si256(vlo, 1));
+    __m128i h = _mm_max_epi32(_mm256_castsi256_si128(vhi),
+                              _mm256_extracti128_si256(vhi, 1));
+    reduceSse(l, h, lo, hi);
+}
+
+__attribute__ ((target("avx2")))
+static void boundsAvx2(const qint32 *p, int n, qint32 & lo, qint32 & hi)
+{
+    __m256i vlo = _mm256_set1_epi32(lo);
+    __m256i vhi = _mm256_set1_epi32(hi);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        vlo = _mm256_min_epi32(vlo, v);
+        vhi = _mm256_max_epi32(vhi, v);
+    }
+    reduceAvx2(vlo, vhi, lo, hi);
+    boundsScalar(p + i, n - i, lo, hi);
+}
+
+__attribute__ ((target("avx2")))
+static void transformAvx2(qint32 *p, int n, qint32 scale, qint32 offset,
+                          qint32 & lo, qint32 & hi)
+{
+    __m256i s = _mm256_set1_epi32(scale);
+    __m256i o = _mm256_set1_epi32(offset);
+    __m256i vlo = _mm256_set1_epi32(lo);
+    __m256i vhi = _mm256_set1_epi32(hi);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        v = _mm256_add_epi32(_mm256_mullo_epi32(v, s), o);
+        _mm256_storeu_si256((__m256i *) (p + i), v);
+        vlo = _mm256_min_epi32(vlo, v);
+        vhi = _mm256_max_epi32(vhi, v);
+    }
+    reduceAvx2(vlo, vhi, lo, hi);
+    transformScalar(p + i, n - i, scale, offset, lo, hi);
+}
+
+#endif // SEGMENT_SIMD
+
+// Best kernels for this cpu
+struct SegmentKernels
+{
+    const char *name;
+    BoundsKernel bounds;
+    TransformKernel transform;
+
+    SegmentKernels()
+    :  name("scalar"), bounds(boundsScalar), transform(transformScalar)
+    {
+#ifdef SEGMENT_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            name = "avx2";
+            bounds = boundsAvx2;
+            transform = transformAvx2;
+        } else if (__builtin_cpu_supports("sse4.1")) {
+            name = "sse4.1";
+            bounds = boundsSse41;
+            transform = transformSse41;
+        }
+#endif
+    }
+};
+
+static const SegmentKernels & kernels()
+{
+    static SegmentKernels k;
+    return k;
+}
+
+const char *segmentKernelName()
+{
+    return kernels().name;
+}
+
+SegmentBounds SegmentTransform::map(const SegmentBounds & bounds) const
+{
+    qint64 ax = bounds.minX * scaleX + offsetX;
+    qint64 bx = bounds.maxX * scaleX + offsetX;
+    qint64 ay = bounds.minY * scaleY + offsetY;
+    qint64 by = bounds.maxY * scaleY + offsetY;
+
+    SegmentBounds res;
+    res.minX = qMin(ax, bx);
+    res.maxX = qMax(ax, bx);
+    res.minY = qMin(ay, by);
+    res.maxY = qMax(ay, by);
+    return res;
+}
+
+SegmentBounds segmentBounds(const SegmentStore & segs)
+{
+    SegmentBounds res;
+    int n = segs.count();
+    if (n == 0) {
+        return res;
+    }
+
+    BoundsKernel bounds = kernels().bounds;
+    qint32 minX = segs.x1[0];
+    qint32 maxX = minX;
+    qint32 minY = segs.y1[0];
+    qint32 maxY = minY;
+    bounds(segs.x1.constData(), n, minX, maxX);
+    bounds(segs.x2.constData(), n, minX, maxX);
+    bounds(segs.y1.constData(), n, minY, maxY);
+    bounds(segs.y2.constData(), n, minY, maxY);
+    res.add(minX, minY);
+    res.add(maxX, maxY);
+    return res;
+}
+
+bool transformSegments(SegmentStore & segs, const SegmentTransform & t,
+                       const SegmentBounds & inBounds,
+                       SegmentBounds & outBounds, QString & error)
+{
+    int n = segs.count();
+    if (n == 0) {
+        outBounds = SegmentBounds();
+        return true;
+    }
+
+    if (!SegmentStore::fitsCoord(t.scaleX) ||
+        !SegmentStore::fitsCoord(t.scaleY) ||
+        qAbs(t.offsetX) > MAX_TRANSFORM_OFFSET ||
+        qAbs(t.offsetY) > MAX_TRANSFORM_OFFSET ||
+        !SegmentStore::fitsCoord(inBounds.minX) ||
+        !SegmentStore::fitsCoord(inBounds.maxX) ||
+        !SegmentStore::fitsCoord(inBounds.minY) ||
+        !SegmentStore::fitsCoord(inBounds.maxY)) {
+        error = "transform out of range";
+        return false;
+    }
+    SegmentBounds mapped = t.map(inBounds);
+    if (!SegmentStore::fitsCoord(mapped.minX) ||
+        !SegmentStore::fitsCoord(mapped.maxX) ||
+        !SegmentStore::fitsCoord(mapped.minY) ||
+        !SegmentStore::fitsCoord(mapped.maxY)) {
+        error = "transformed coordinates out of range";
+        return false;
+    }
+
+    TransformKernel transform = kernels().transform;
+    qint32 sx = (qint32) t.scaleX;
+    qint32 sy = (qint32) t.scaleY;
+    qint32 ox = (qint32) (quint32) t.offsetX;
+    qint32 oy = (qint32) (quint32) t.offsetY;
+    qint32 minX = 0x7fffffff;
+    qint32 maxX = -0x7fffffff - 1;
+    qint32 minY = 0x7fffffff;
+    qint32 maxY = -0x7fffffff - 1;
+    transform(segs.x1.data(), n, sx, ox, minX, maxX);
+    transform(segs.x2.data(), n, sx, ox, minX, maxX);
+    transform(segs.y1.data(), n, sy, oy, minY, maxY);
+    transform(segs.y2.data(), n, sy, oy, minY, maxY);
+
+    outBounds = SegmentBounds();
+    outBounds.add(minX, minY);
+    outBounds.add(maxX, maxY);
+    return true;
+}
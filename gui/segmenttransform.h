@@ -0,0 +1,46 @@
+#ifndef SEGMENTTRANSFORM_H
+#define SEGMENTTRANSFORM_H
+
+#include <QString>
+
+#include "segmentstore.h"
+
+// Per axis affine transform of segment coordinates:
+//
+//   x' = x * scaleX + offsetX
+//   y' = y * scaleY + offsetY
+//
+// Scale -1 mirrors the axis. Results must fit in 32 bits, see
+// transformSegments().
+struct SegmentTransform
+{
+    qint64 scaleX;
+    qint64 offsetX;
+    qint64 scaleY;
+    qint64 offsetY;
+
+    SegmentTransform()
+    :  scaleX(1), offsetX(0), scaleY(1), offsetY(0)
+    {
+    }
+
+    // Bounds of transformed box, exact in 64 bits
+    SegmentBounds map(const SegmentBounds & bounds) const;
+};
+
+// Exact bounds of all segment end points. Max starts at 0 like in
+// SegmentBounds::add().
+SegmentBounds segmentBounds(const SegmentStore & segs);
+
+// Transform segments in place and compute bounds of the result in the same
+// pass. inBounds must contain all coordinates, it is used to check that
+// results fit in 32 bits before anything is changed. Returns false with
+// error set if they would not.
+bool transformSegments(SegmentStore & segs, const SegmentTransform & t,
+                       const SegmentBounds & inBounds,
+                       SegmentBounds & outBounds, QString & error);
+
+// Instruction set used by the kernels: "avx2", "sse4.1" or "scalar"
+const char *segmentKernelName();
+
+#endif // SEGMENTTRANSFORM_H
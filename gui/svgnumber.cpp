@@ -0,0 +1,138 @@
+#include "svgnumber.h"
+
+// Mantissa keeps at most 19 significant digits, which always fit in quint64
+#define MAX_DIGITS 19
+
+static const quint64 pow10[MAX_DIGITS + 1] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+bool parseSvgNumber(const char *&p, const char *end, qint64 & val)
+{
+    const char *s = p;
+    bool neg = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        neg = (*s == '-');
+        s++;
+    }
+
+    // Number is m * 10^exp10
+    quint64 m = 0;
+    int digits = 0;
+    int exp10 = 0;
+    const char *start = s;
+    for (; s < end; s++) {
+        unsigned d = (unsigned char) *s - '0';
+        if (d > 9) {
+            break;
+        }
+        if (digits < MAX_DIGITS) {
+            m = m * 10 + d;
+            digits += (m != 0);  // leading zeros are not significant
+        } else {
+            exp10++;
+        }
+    }
+    bool intDigits = (s != start);
+
+    bool fracDigits = false;
+    if (s < end && *s == '.') {
+        s++;
+        start = s;
+        for (; s < end; s++) {
+            unsigned d = (unsigned char) *s - '0';
+            if (d > 9) {
+                break;
+            }
+            if (digits < MAX_DIGITS) {
+                m = m * 10 + d;
+                digits += (m != 0);
+                exp10--;
+            }
+        }
+        fracDigits = (s != start);
+    }
+    if (!intDigits && !fracDigits) {
+        return false;
+    }
+
+    // Exponent is consumed only if there are digits after it
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool expNeg = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            expNeg = (*e == '-');
+            e++;
+        }
+        if (e < end && (unsigned) ((unsigned char) *e - '0') <= 9) {
+            int x = 0;
+            for (; e < end; e++) {
+                unsigned d = (unsigned char) *e - '0';
+                if (d > 9) {
+                    break;
+                }
+                x = (x < 100000 ? x * 10 + d : x);
+            }
+            exp10 += (expNeg ? -x : x);
+            s = e;
+        }
+    }
+
+    exp10 += 3;                 // svg pixels * 1000
+
+    quint64 res;
+    if (m == 0 || exp10 < -MAX_DIGITS) {
+        res = 0;
+    } else if (exp10 >= 0) {
+        // saturate, SegmentStore rejects it as out of range anyway
+        quint64 limit = 0x7fffffffffffffffULL;
+        if (exp10 > MAX_DIGITS || m > limit / pow10[exp10]) {
+            res = limit;
+        } else {
+            res = m * pow10[exp10];
+        }
+    } else {
+        quint64 div = pow10[-exp10];
+        quint64 rem = m % div;
+        res = m / div + (rem >= div - rem);     // round half away from zero
+    }
+
+    p = s;
+    val = (neg ? -(qint64) res : (qint64) res);
+    return true;
+}
+
+QString num2svg(qint64 num)
+{
+    qint64 th = qAbs(num) / 1000;
+    int rest = qAbs(num) % 1000;
+    QString res = (num >= 0 ? "" : "-");
+    res += QString::number(th);
+    res += '.';
+    if (rest <= 9) {
+        res += "00";
+    } else if (rest <= 99) {
+        res += "0";
+    }
+    res += QString::number(rest);
+    return res;
+}
@@ -0,0 +1,14 @@
+#ifndef SVGNUMBER_H
+#define SVGNUMBER_H
+
+#include <QString>
+
+// Parse svg number (e.g. "12", "-0.5", ".25", "-8e-4", "1.5E+2") at p to
+// svg pixels * 1000, rounded half away from zero. On success p points after
+// the number. Does not allocate, p is never read at or after end.
+bool parseSvgNumber(const char *&p, const char *end, qint64 & val);
+
+// Format svg pixels * 1000 as decimal number with 3 decimal places
+QString num2svg(qint64 num);
+
+#endif // SVGNUMBER_H
@@ -0,0 +1,426 @@
+#include "svgreader.h"
+#include "svgnumber.h"
+
+#include <QFile>
+#include <math.h>
+#include <string.h>
+
+// Max depth of bezier subdivision, 2^16 lines per curve
+#define MAX_CURVE_DEPTH 16
+
+// Max number of lines per arc
+#define MAX_ARC_LINES 100000
+
+static inline bool isSpace(char ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+}
+
+// Number of arguments for path command, 0 for unknown commands
+static int argCount(char cmd)
+{
+    switch (cmd) {
+    case 'M':
+    case 'm':
+    case 'L':
+    case 'l':
+    case 'T':
+    case 't':
+        return 2;
+    case 'H':
+    case 'h':
+    case 'V':
+    case 'v':
+        return 1;
+    case 'C':
+    case 'c':
+        return 6;
+    case 'S':
+    case 's':
+    case 'Q':
+    case 'q':
+        return 4;
+    case 'A':
+    case 'a':
+        return 7;
+    }
+    return 0;
+}
+
+QByteArray SvgParseOptions::key() const
+{
+    return "reader" + QByteArray::number(SVG_READER_VERSION) +
+        " tolerance" + QByteArray::number(tolerance) +
+        " simplify" + QByteArray::number(simplifyTolerance);
+}
+
+SvgReader::SvgReader(SvgSegmentSink * sink, const SvgParseOptions & options)
+:  sink(sink), options(options), paths(0), segments(0), stopped(false)
+{
+    if (this->options.tolerance < 1) {
+        this->options.tolerance = 1;
+    }
+}
+
+QString SvgReader::errorString() const
+{
+    return error;
+}
+
+int SvgReader::pathCount() const
+{
+    return paths;
+}
+
+int SvgReader::segmentCount() const
+{
+    return segments;
+}
+
+bool SvgReader::readFile(const QString & path)
+{
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly)) {
+        error = f.errorString();
+        return false;
+    }
+
+    bool res;
+    qint64 size = f.size();
+    uchar *data = (size > 0 ? f.map(0, size) : NULL);
+    if (data) {
+        res = read((const char *) data, size);
+        f.unmap(data);
+    } else {
+        // mapping not supported (e.g. pipe), read it at once
+        QByteArray bytes = f.readAll();
+        res = read(bytes.constData(), bytes.size());
+    }
+    f.close();
+    return res;
+}
+
+// Find d="..." attributes and parse the path data in them
+bool SvgReader::read(const char *data, qint64 len)
+{
+    const char *p = data;
+    const char *end = data + len;
+
+    paths = 0;
+    segments = 0;
+    stopped = false;
+
+    while (p < end && !stopped) {
+        const char *d = (const char *) memchr(p, 'd', end - p);
+        if (!d) {
+            break;
+        }
+        p = d + 1;
+        if (d > data && !isSpace(d[-1])) {
+            continue;           // e.g. id="..."
+        }
+
+        const char *q = p;
+        while (q < end && isSpace(*q)) {
+            q++;
+        }
+        if (q >= end || *q != '=') {
+            continue;
+        }
+        q++;
+        while (q < end && isSpace(*q)) {
+            q++;
+        }
+        if (q >= end || (*q != '"' && *q != '\'')) {
+            continue;
+        }
+
+        paths++;
+        p = readPath(q + 1, end, *q);
+    }
+    return true;
+}
+
+bool SvgReader::emitSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2)
+{
+    segments++;
+    if (!sink->addSegment(x1, y1, x2, y2)) {
+        stopped = true;
+    }
+    return !stopped;
+}
+
+// Flatness test of cubic bezier in fixed point. Curve is flat if its
+// distance from the chord is within tolerance, the distance is bounded by
+// 3/4 of max distance of control points from the 1/3 and 2/3 chord points.
+bool SvgReader::isFlat(qint64 x0, qint64 y0, qint64 x1, qint64 y1,
+                       qint64 x2, qint64 y2, qint64 x3, qint64 y3) const
+{
+    qint64 ux = 3 * x1 - 2 * x0 - x3;
+    qint64 uy = 3 * y1 - 2 * y0 - y3;
+    qint64 vx = 3 * x2 - x0 - 2 * x3;
+    qint64 vy = 3 * y2 - y0 - 2 * y3;
+
+    // squares below would overflow, split such huge curve anyway
+    qint64 limit = 0x40000000LL;
+    if (qAbs(ux) > limit || qAbs(uy) > limit ||
+        qAbs(vx) > limit || qAbs(vy) > limit) {
+        return false;
+    }
+
+    ux *= ux;
+    uy *= uy;
+    vx *= vx;
+    vy *= vy;
+    ux = (vx > ux ? vx : ux);
+    uy = (vy > uy ? vy : uy);
+    return ux + uy <= 16 * options.tolerance * options.tolerance;
+}
+
+// Adaptive subdivision of cubic bezier (de Casteljau at t=0.5)
+void SvgReader::flattenCubic(qint64 x0, qint64 y0, qint64 x1, qint64 y1,
+                             qint64 x2, qint64 y2, qint64 x3, qint64 y3,
+                             int depth)
+{
+    if (stopped) {
+        return;
+    }
+    if (depth >= MAX_CURVE_DEPTH || isFlat(x0, y0, x1, y1, x2, y2, x3, y3)) {
+        emitSegment(x0, y0, x3, y3);
+        return;
+    }
+
+    qint64 x01 = (x0 + x1) >> 1;
+    qint64 y01 = (y0 + y1) >> 1;
+    qint64 x12 = (x1 + x2) >> 1;
+    qint64 y12 = (y1 + y2) >> 1;
+    qint64 x23 = (x2 + x3) >> 1;
+    qint64 y23 = (y2 + y3) >> 1;
+    qint64 x012 = (x01 + x12) >> 1;
+    qint64 y012 = (y01 + y12) >> 1;
+    qint64 x123 = (x12 + x23) >> 1;
+    qint64 y123 = (y12 + y23) >> 1;
+    qint64 xm = (x012 + x123) >> 1;
+    qint64 ym = (y012 + y123) >> 1;
+
+    flattenCubic(x0, y0, x01, y01, x012, y012, xm, ym, depth + 1);
+    flattenCubic(xm, ym, x123, y123, x23, y23, x3, y3, depth + 1);
+}
+
+// Elliptical arc from x0,y0 to x1,y1, angle is in degrees * 1000. Center
+// parametrization is computed as in svg spec (appendix F.6.5), the arc is
+// then split into equal angle steps so that chord error on the bigger
+// radius is within tolerance.
+void SvgReader::flattenArc(qint64 x0, qint64 y0, qint64 rx, qint64 ry,
+                           qint64 angle, bool largeArc, bool sweep,
+                           qint64 x1, qint64 y1)
+{
+    if (x0 == x1 && y0 == y1) {
+        return;
+    }
+    double rxf = qAbs(rx);
+    double ryf = qAbs(ry);
+    if (rxf == 0 || ryf == 0) {
+        emitSegment(x0, y0, x1, y1);
+        return;
+    }
+
+    double phi = (angle / 1000.0) * M_PI / 180.0;
+    double c = cos(phi);
+    double s = sin(phi);
+    double dx = (x0 - x1) / 2.0;
+    double dy = (y0 - y1) / 2.0;
+    double x1p = c * dx + s * dy;
+    double y1p = -s * dx + c * dy;
+
+    // radii too small, scale them up
+    double lambda = (x1p * x1p) / (rxf * rxf) + (y1p * y1p) / (ryf * ryf);
+    if (lambda > 1) {
+        rxf *= sqrt(lambda);
+        ryf *= sqrt(lambda);
+    }
+
+    double rx2 = rxf * rxf;
+    double ry2 = ryf * ryf;
+    double num = rx2 * ry2 - rx2 * y1p * y1p - ry2 * x1p * x1p;
+    double den = rx2 * y1p * y1p + ry2 * x1p * x1p;
+    double coef = (num > 0 && den > 0 ? sqrt(num / den) : 0);
+    if (largeArc == sweep) {
+        coef = -coef;
+    }
+    double cxp = coef * rxf * y1p / ryf;
+    double cyp = -coef * ryf * x1p / rxf;
+    double cx = c * cxp - s * cyp + (x0 + x1) / 2.0;
+    double cy = s * cxp + c * cyp + (y0 + y1) / 2.0;
+
+    double theta = atan2((y1p - cyp) / ryf, (x1p - cxp) / rxf);
+    double theta2 = atan2((-y1p - cyp) / ryf, (-x1p - cxp) / rxf);
+    double dtheta = theta2 - theta;
+    if (sweep && dtheta < 0) {
+        dtheta += 2 * M_PI;
+    } else if (!sweep && dtheta > 0) {
+        dtheta -= 2 * M_PI;
+    }
+
+    double r = (rxf > ryf ? rxf : ryf);
+    double step = M_PI / 2;
+    if (options.tolerance < r) {
+        double a = 2 * acos(1 - options.tolerance / r);
+        step = (a < step ? a : step);
+    }
+    int n = (int) ceil(fabs(dtheta) / step);
+    n = (n < 1 ? 1 : (n > MAX_ARC_LINES ? MAX_ARC_LINES : n));
+
+    qint64 px = x0;
+    qint64 py = y0;
+    for (int i = 1; i <= n && !stopped; i++) {
+        qint64 qx = x1;
+        qint64 qy = y1;
+        if (i < n) {
+            double t = theta + (dtheta * i) / n;
+            double ex = rxf * cos(t);
+            double ey = ryf * sin(t);
+            qx = qRound64(c * ex - s * ey + cx);
+            qy = qRound64(s * ex + c * ey + cy);
+        }
+        emitSegment(px, py, qx, qy);
+        px = qx;
+        py = qy;
+    }
+}
+
+// Parse path data up to the closing quote, returns position after it
+const char *SvgReader::readPath(const char *p, const char *end, char quote)
+{
+    qint64 cx = 0;              // current point
+    qint64 cy = 0;
+    qint64 sx = 0;              // start of current subpath
+    qint64 sy = 0;
+    qint64 qx = 0;              // last control point for S and T commands
+    qint64 qy = 0;
+    char last = 0;              // last executed command (upper case)
+    qint64 args[7];
+    int argc = 0;
+    int count = 0;
+    char cmd = 0;
+
+    while (p < end && *p != quote && !stopped) {
+        char ch = *p;
+        if (isSpace(ch) || ch == ',') {
+            p++;
+            continue;
+        }
+        if (ch != 'e' && ch != 'E' &&
+            ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))) {
+            cmd = ch;
+            count = argCount(cmd);
+            argc = 0;
+            p++;
+            if (cmd == 'z' || cmd == 'Z') {
+                if (cx != sx || cy != sy) {
+                    emitSegment(cx, cy, sx, sy);
+                }
+                cx = sx;
+                cy = sy;
+                last = 'Z';
+            }
+            continue;
+        }
+        if ((cmd == 'a' || cmd == 'A') && (argc == 3 || argc == 4) &&
+            (ch == '0' || ch == '1')) {
+            args[argc] = ch - '0';      // arc flags may be written as "01"
+            p++;
+        } else if (!parseSvgNumber(p, end, args[argc])) {
+            p++;                // garbage
+            continue;
+        }
+        if (count == 0 || ++argc < count) {
+            continue;
+        }
+        argc = 0;
+
+        // Relative commands are lower case
+        bool rel = (cmd >= 'a');
+        char upper = (rel ? cmd - 'a' + 'A' : cmd);
+        qint64 ox = (rel ? cx : 0);
+        qint64 oy = (rel ? cy : 0);
+        qint64 tx = cx;
+        qint64 ty = cy;
+        qint64 x1;
+        qint64 y1;
+        if (count >= 2) {
+            tx = ox + args[count - 2];  // end point of the command
+            ty = oy + args[count - 1];
+        }
+
+        switch (upper) {
+        case 'M':
+            cx = sx = tx;
+            cy = sy = ty;
+            cmd = (rel ? 'l' : 'L');    // next pairs are lines
+            last = 'M';
+            continue;
+        case 'H':
+            tx = ox + args[0];
+            ty = cy;
+            emitSegment(cx, cy, tx, ty);
+            break;
+        case 'V':
+            tx = cx;
+            ty = oy + args[0];
+            emitSegment(cx, cy, tx, ty);
+            break;
+        case 'L':
+            emitSegment(cx, cy, tx, ty);
+            break;
+        case 'C':
+        case 'S':
+            if (upper == 'C') {
+                x1 = ox + args[0];
+                y1 = oy + args[1];
+            } else if (last == 'C' || last == 'S') {
+                x1 = 2 * cx - qx;       // reflection of last control point
+                y1 = 2 * cy - qy;
+            } else {
+                x1 = cx;
+                y1 = cy;
+            }
+            qx = ox + args[count - 4];
+            qy = oy + args[count - 3];
+            flattenCubic(cx, cy, x1, y1, qx, qy, tx, ty, 0);
+            break;
+        case 'Q':
+        case 'T':
+            if (upper == 'Q') {
+                x1 = ox + args[0];
+                y1 = oy + args[1];
+            } else if (last == 'Q' || last == 'T') {
+                x1 = 2 * cx - qx;
+                y1 = 2 * cy - qy;
+            } else {
+                x1 = cx;
+                y1 = cy;
+            }
+            qx = x1;
+            qy = y1;
+            // same curve as cubic with control points at 2/3 of the way
+            flattenCubic(cx, cy, cx + (2 * (x1 - cx)) / 3,
+                         cy + (2 * (y1 - cy)) / 3, tx + (2 * (x1 - tx)) / 3,
+                         ty + (2 * (y1 - ty)) / 3, tx, ty, 0);
+            break;
+        case 'A':
+            flattenArc(cx, cy, args[0], args[1], args[2], args[3] != 0,
+                       args[4] != 0, tx, ty);
+            break;
+        }
+
+        cx = tx;
+        cy = ty;
+        last = upper;
+    }
+
+    while (p < end && *p != quote) {
+        p++;
+    }
+    return (p < end ? p + 1 : end);
+}
@@ -0,0 +1,80 @@
+#ifndef SVGREADER_H
+#define SVGREADER_H
+
+#include <QByteArray>
+#include <QString>
+
+// Bump when parsing results change, invalidates the geometry cache
+#define SVG_READER_VERSION 3
+
+// Options of svg parsing, all of them are part of the geometry cache key
+struct SvgParseOptions
+{
+    // Max distance of flattened curve from the real one in svg pixels * 1000.
+    // Default 50 is ~0.014mm, less then two motor steps.
+    qint64 tolerance;
+
+    // Max distance of simplified polylines from the parsed ones, see
+    // PolylineSimplifier. 0 merges exactly collinear segments only.
+    qint64 simplifyTolerance;
+
+    SvgParseOptions()
+    :  tolerance(50), simplifyTolerance(0)
+    {
+    }
+
+    QByteArray key() const;
+};
+
+// Receives segments parsed by SvgReader, coordinates are in svg pixels * 1000
+class SvgSegmentSink
+{
+public:
+    virtual ~SvgSegmentSink()
+    {
+    }
+
+    // Return false to stop reading
+    virtual bool addSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2) = 0;
+};
+
+// Single pass reader of svg path data (d="..." attributes).
+//
+// The file is memory mapped and scanned once, path data may span several
+// lines. All path commands are supported in absolute and relative form.
+// Bezier curves and elliptical arcs are flattened to lines, the number of
+// lines depends on curve size and options.tolerance. Segments go directly
+// to the sink.
+class SvgReader
+{
+public:
+    SvgReader(SvgSegmentSink *sink,
+              const SvgParseOptions & options = SvgParseOptions());
+
+    bool readFile(const QString & path);
+    bool read(const char *data, qint64 len);
+
+    QString errorString() const;
+    int pathCount() const;
+    int segmentCount() const;
+
+private:
+    SvgSegmentSink *sink;
+    SvgParseOptions options;
+    QString error;
+    int paths;
+    int segments;
+    bool stopped;
+
+    const char *readPath(const char *p, const char *end, char quote);
+    bool emitSegment(qint64 x1, qint64 y1, qint64 x2, qint64 y2);
+    bool isFlat(qint64 x0, qint64 y0, qint64 x1, qint64 y1,
+                qint64 x2, qint64 y2, qint64 x3, qint64 y3) const;
+    void flattenCubic(qint64 x0, qint64 y0, qint64 x1, qint64 y1,
+                      qint64 x2, qint64 y2, qint64 x3, qint64 y3, int depth);
+    void flattenArc(qint64 x0, qint64 y0, qint64 rx, qint64 ry,
+                    qint64 angle, bool largeArc, bool sweep,
+                    qint64 x1, qint64 y1);
+};
+
+#endif // SVGREADER_H
@@ -0,0 +1,195 @@
+#include "svgwriter.h"
+
+#include <string.h>
+
+// Max length of formatted number: sign, 19 digits and dot
+#define MAX_NUMBER_LEN 24
+
+SvgWriter::SvgWriter(QIODevice * dev)
+:  dev(dev), len(0), written(0), paths(0), error(false), inPath(false),
+   lastX(0), lastY(0)
+{
+}
+
+SvgWriter::~SvgWriter()
+{
+    if (inPath) {
+        endPath();
+    }
+    flush();
+}
+
+bool SvgWriter::hasError() const
+{
+    return error;
+}
+
+qint64 SvgWriter::bytesWritten() const
+{
+    return written + len;
+}
+
+int SvgWriter::pathCount() const
+{
+    return paths;
+}
+
+bool SvgWriter::flush()
+{
+    if (len > 0 && !error) {
+        if (dev->write(buf, len) != len) {
+            error = true;
+        }
+        written += len;
+    }
+    len = 0;
+    return !error;
+}
+
+// Make sure there is space for n more bytes in the buffer
+void SvgWriter::reserve(int n)
+{
+    if (len + n > SVG_WRITER_BUFFER) {
+        flush();
+    }
+}
+
+void SvgWriter::write(const char *str, int n)
+{
+    while (n > 0) {
+        reserve(1);
+        int chunk = qMin(n, SVG_WRITER_BUFFER - len);
+        memcpy(buf + len, str, chunk);
+        len += chunk;
+        str += chunk;
+        n -= chunk;
+    }
+}
+
+void SvgWriter::write(const char *str)
+{
+    write(str, strlen(str));
+}
+
+// Format svg pixels * 1000, e.g. 12340 -> "12.34", -500 -> "-0.5"
+void SvgWriter::writeNumber(qint64 num)
+{
+    reserve(MAX_NUMBER_LEN);
+
+    quint64 abs = (num < 0 ? 0 - (quint64) num : (quint64) num);
+    quint64 th = abs / 1000;
+    int rest = abs % 1000;
+
+    // Digits of whole part are produced backwards
+    char tmp[MAX_NUMBER_LEN];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + th % 10;
+        th /= 10;
+    } while (th > 0);
+
+    char *p = buf + len;
+    if (num < 0) {
+        *p++ = '-';
+    }
+    while (n > 0) {
+        *p++ = tmp[--n];
+    }
+    if (rest != 0) {
+        *p++ = '.';
+        *p++ = '0' + rest / 100;
+        rest %= 100;
+        if (rest != 0) {
+            *p++ = '0' + rest / 10;
+            rest %= 10;
+            if (rest != 0) {
+                *p++ = '0' + rest;
+            }
+        }
+    }
+    len = p - buf;
+}
+
+void SvgWriter::beginGroup(const char *style)
+{
+    write("<g style=\"");
+    write(style);
+    write("\">\n");
+}
+
+void SvgWriter::endGroup()
+{
+    if (inPath) {
+        endPath();
+    }
+    write("</g>\n");
+}
+
+void SvgWriter::moveTo(qint64 x, qint64 y)
+{
+    if (inPath) {
+        endPath();
+    }
+    write("<path d=\"m ", 11);
+    writeNumber(x);
+    write(",", 1);
+    writeNumber(y);
+    inPath = true;
+    lastX = x;
+    lastY = y;
+    paths++;
+}
+
+void SvgWriter::lineTo(qint64 x, qint64 y)
+{
+    write(" ", 1);
+    writeNumber(x - lastX);
+    write(",", 1);
+    writeNumber(y - lastY);
+    lastX = x;
+    lastY = y;
+}
+
+void SvgWriter::closePath()
+{
+    write(" z", 2);
+}
+
+void SvgWriter::endPath()
+{
+    write("\"/>\n", 4);
+    inPath = false;
+}
+
+void SvgWriter::writeSegments(const SegmentStore & segs)
+{
+    const qint32 *x1 = segs.x1.constData();
+    const qint32 *y1 = segs.y1.constData();
+    const qint32 *x2 = segs.x2.constData();
+    const qint32 *y2 = segs.y2.constData();
+    int count = segs.count();
+
+    int start = 0;
+    while (start < count) {
+        // Find end of chain of connected segments
+        int end = start + 1;
+        while (end < count && x1[end] == x2[end - 1] &&
+               y1[end] == y2[end - 1]) {
+            end++;
+        }
+
+        // Last segment of closed chain is replaced by "z" which goes back
+        // to the start
+        bool closed = (end - start > 1 && x2[end - 1] == x1[start] &&
+                       y2[end - 1] == y1[start]);
+        moveTo(x1[start], y1[start]);
+        for (int i = start; i < end - (closed ? 1 : 0); i++) {
+            lineTo(x2[i], y2[i]);
+        }
+        if (closed) {
+            closePath();
+        }
+        endPath();
+        start = end;
+    }
+}
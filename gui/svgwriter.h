@@ -0,0 +1,62 @@
+#ifndef SVGWRITER_H
+#define SVGWRITER_H
+
+#include <QIODevice>
+
+#include "segmentstore.h"
+
+// Size of SvgWriter output buffer
+#define SVG_WRITER_BUFFER 65536
+
+// Streaming writer of svg path elements.
+//
+// Output goes through a fixed buffer which is written to the device when
+// full, numbers are formatted directly into the buffer. Coordinates are
+// svg pixels * 1000 (same as SvgReader), written with up to 3 decimal
+// places and no trailing zeros.
+class SvgWriter
+{
+public:
+    SvgWriter(QIODevice *dev);
+    ~SvgWriter();
+
+    // <g style="..."> wrapper so that style is written just once
+    void beginGroup(const char *style);
+    void endGroup();
+
+    // Path data, moveTo() starts new <path> element and endPath() ends it.
+    // Points after the first one are written relative.
+    void moveTo(qint64 x, qint64 y);
+    void lineTo(qint64 x, qint64 y);
+    void closePath();
+    void endPath();
+
+    // Write segments as paths, connected consecutive segments are joined
+    // into one <path>, closed chains end with "z"
+    void writeSegments(const SegmentStore & segs);
+
+    // Write buffered data to device, returns false on write error
+    bool flush();
+
+    bool hasError() const;
+    qint64 bytesWritten() const;
+    int pathCount() const;
+
+private:
+    QIODevice *dev;
+    char buf[SVG_WRITER_BUFFER];
+    int len;
+    qint64 written;
+    int paths;
+    bool error;
+    bool inPath;
+    qint64 lastX;
+    qint64 lastY;
+
+    void write(const char *str);
+    void write(const char *str, int n);
+    void writeNumber(qint64 num);
+    void reserve(int n);
+};
+
+#endif // SVGWRITER_H
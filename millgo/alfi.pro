@@ -7,13 +7,20 @@
 TARGET = alfi
 TEMPLATE = app
 
+INCLUDEPATH += ../gui
 
 SOURCES += main.cpp\
         mainwindow.cpp \
+    jobjournal.cpp \
+    ../gui/cmdcodec.cpp \
+    ../gui/cmdlink.cpp \
     qserialiodevice.cpp \
     qserialport.cpp
 
 HEADERS  += mainwindow.h \
+    jobjournal.h \
+    ../gui/cmdcodec.h \
+    ../gui/cmdlink.h \
     qserialiodevice_p.h \
     qserialiodevice.h \
     qserialport.h \
@@ -0,0 +1,118 @@
+#include "jobjournal.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+
+#include <string.h>
+#include <unistd.h>
+
+#define JOB_JOURNAL_MAGIC "ALFIJRN1"
+
+struct JobJournalHeader
+{
+    char magic[8];
+    char key[20];               // sha1 of job file content
+};
+
+struct JobJournalRecord
+{
+    JobCheckpoint cp;
+    quint32 check;              // qChecksum of cp
+    quint32 reserved;
+};
+
+JobJournal::JobJournal(const QString & path, int syncEvery)
+:  file(path), syncEvery(syncEvery), unsynced(0)
+{
+}
+
+QByteArray JobJournal::key(QFile & job)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    job.seek(0);
+    for (;;) {
+        QByteArray data = job.read(65536);
+        if (data.isEmpty()) {
+            break;
+        }
+        hash.addData(data);
+    }
+    job.seek(0);
+    return hash.result();
+}
+
+bool JobJournal::open(const QByteArray & key, JobCheckpoint & last)
+{
+    if (!file.open(QFile::ReadWrite)) {
+        qWarning() << "failed to open " << file.fileName() << ": " <<
+            file.errorString();
+        return false;
+    }
+
+    // Records after a torn one are not trusted
+    bool resume = false;
+    qint64 good = 0;            // length of valid header and records
+    JobJournalHeader hdr;
+    if (file.read((char *) &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        memcmp(hdr.magic, JOB_JOURNAL_MAGIC, 8) == 0 &&
+        memcmp(hdr.key, key.constData(), 20) == 0) {
+        good = sizeof(hdr);
+        JobJournalRecord rec;
+        while (file.read((char *) &rec, sizeof(rec)) == sizeof(rec) &&
+               rec.check ==
+               qChecksum((const char *) &rec.cp, sizeof(rec.cp))) {
+            last = rec.cp;
+            resume = true;
+            good += sizeof(rec);
+        }
+    }
+    if (good > 0) {
+        file.resize(good);
+        file.seek(good);
+        return resume;
+    }
+
+    // Journal of other job or none, start new one
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, JOB_JOURNAL_MAGIC, 8);
+    memcpy(hdr.key, key.constData(), 20);
+    file.resize(0);
+    file.seek(0);
+    if (file.write((const char *) &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        !sync()) {
+        qWarning() << "failed to write " << file.fileName();
+    }
+    return false;
+}
+
+bool JobJournal::append(const JobCheckpoint & cp)
+{
+    if (!file.isOpen()) {
+        return false;
+    }
+    JobJournalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.cp = cp;
+    rec.check = qChecksum((const char *) &rec.cp, sizeof(rec.cp));
+    if (file.write((const char *) &rec, sizeof(rec)) != sizeof(rec) ||
+        !file.flush()) {
+        qWarning() << "failed to write " << file.fileName();
+        return false;
+    }
+    if (syncEvery > 0 && ++unsynced >= syncEvery) {
+        return sync();
+    }
+    return true;
+}
+
+bool JobJournal::sync()
+{
+    unsynced = 0;
+    return file.flush() && fsync(file.handle()) == 0;
+}
+
+void JobJournal::remove()
+{
+    file.close();
+    file.remove();
+}
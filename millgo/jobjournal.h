@@ -0,0 +1,51 @@
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+// Progress of a job after a queue is done
+struct JobCheckpoint
+{
+    qint64 offset;              // next line of job file to send
+    qint32 queueId;
+    qint32 x;                   // machine position in job coordinates
+    qint32 y;
+    qint32 z;
+};
+
+// Append-only journal of job progress, so that an interrupted job can
+// continue from the last queue arduino finished.
+//
+// Header holds sha1 of job file content, then fixed size checkpoint
+// records with checksum follow. Each done queue appends one record, the
+// job file itself is never rewritten. Torn or corrupt records at the end
+// are ignored on open, so the last good checkpoint is used.
+class JobJournal
+{
+public:
+    // Records are synced to disk every syncEvery appends, 0 leaves it to
+    // the system
+    JobJournal(const QString & path, int syncEvery);
+
+    static QByteArray key(QFile & job);
+
+    // Open journal of job with key. Returns true and its last checkpoint if
+    // the journal is of the same job, else starts a new journal.
+    bool open(const QByteArray & key, JobCheckpoint & last);
+
+    bool append(const JobCheckpoint & cp);
+
+    // Job done, journal is not needed any more
+    void remove();
+
+private:
+    QFile file;
+    int syncEvery;
+    int unsynced;               // records appended since last sync
+
+    bool sync();
+};
+
+#endif // JOBJOURNAL_H
@@ -28,6 +28,11 @@
 
 #define QUEUE_LEN 30
 
+// Job progress for resume, synced to disk every JOURNAL_SYNC_EVERY done
+// queues. Queues done after the last sync are milled again on resume.
+#define JOURNAL_FILE "job.journal"
+#define JOURNAL_SYNC_EVERY 8
+
 QFile *outFile = NULL;
 
 uchar *prnBits;
@@ -94,7 +99,7 @@ static void MkPrnImg(QImage & img, int width, int height, uchar ** imgBits)
 MainWindow::MainWindow(QWidget * parent)
 :  
 QMainWindow(parent), ui(new Ui::MainWindow), port("/dev/arduino", 115200),
-  moveNo(0), cmdQueue(), milling(false), preview(false), curX(0), curY(0), curZ(0)
+  link(port), moveNo(0), simSeq(0), cmdQueue(), milling(false), preview(false), curX(0), curY(0), curZ(0)
 {
     ui->setupUi(this);
     imgFile = QString::null;
@@ -180,10 +185,17 @@ static void drawLine2(uchar * bits, int x0, int y0, int x1, int y1, int color)
 #define A2 2
 #define OUTPUT 0
 
+typedef unsigned char byte;
+
+long max(long a, long b)
+{
+    return (a > b ? a : b);
+}
+
 class ArduinoSimSerial
 {
 public:
-    QString cmd;
+    QByteArray cmd;
     int pos;
 
     ArduinoSimSerial()
@@ -192,7 +204,7 @@ public:
     ~ArduinoSimSerial()
     {
     }
-    void load(QString cmd)
+    void load(QByteArray cmd)
     {
         this->cmd = cmd;
         pos = 0;
@@ -218,7 +230,7 @@ public:
     };
     char read()
     {
-        return cmd.at(pos++).toAscii();
+        return cmd.at(pos++);
     };
     void write(char)
     {
@@ -349,7 +361,9 @@ void MainWindow::paintEvent(QPaintEvent *)
     return;
 }
 
-// Send cmd queue to arduino. Returns after arduino received it
+// Send cmd queue to arduino. Returns after arduino acked it, which is
+// while the previous queue still runs, arduino keeps the next queue loaded
+// so that it can continue without stopping.
 void MainWindow::writeCmdQueue()
 {
     QString cmd = "q";
@@ -360,10 +374,19 @@ void MainWindow::writeCmdQueue()
     cmd += " e" + QString::number(++moveNo) + " ";
     cmdQueue.clear();
 
-    // Execute on milling machine simulator
-    Serial.load(cmd);
-    int extraLoops = 100;
-    while(Serial.available() || --extraLoops > 0)
+    // Execute on milling machine simulator, frames are sent when they fit
+    // like on real arduino
+    QList<QByteArray> frames = CmdLink::frames(cmd.toAscii(), simSeq);
+    for (int i = 0; i < frames.count(); i++) {
+        while (RX_LEN - rxCount < frames.at(i).at(2)) {
+            loop();
+        }
+        Serial.load(frames.at(i));
+        while (Serial.available()) {
+            loop();
+        }
+    }
+    while (rxCount > 0 || ::cmd != 0 || cmdCount >= 0)
     {
         loop();
     }
@@ -373,71 +396,47 @@ void MainWindow::writeCmdQueue()
         return;
 
     qDebug() << "cmd=" << cmd;
-    QByteArray cmdBytes = cmd.toAscii();
-    int remains = cmdBytes.length();
-    for (int i = 0; remains > 0; i += 64) {
-        int count = (remains >= 64 ? 64 : remains);
-        port.write(cmdBytes.constData() + i, count);
-
-        for (;;) {
-            int avail = port.bytesAvailable();
-            if (avail < count) {
-                port.waitForReadyRead(5);
-                continue;
-            }
-            QByteArray echoBytes = port.read(count);
-            qDebug() << "echo=" << echoBytes;
-            for (int j = 0; j < count; j++) {
-                if (echoBytes.at(j) != cmdBytes.at(i + j)) {
-                    qDebug() << "send data failed!!!";
-                    exit(1);
-                }
-            }
-            break;
-        }
-        remains -= count;
+    if (!encoder.isNegotiated()) {
+        encoder.negotiate(link);
+    }
+    if (!link.write(encoder.encode(cmd.toAscii()))) {
+        QMessageBox::critical(this, "Error", "Arduino does not respond");
     }
-    //    port.write(cmd.toAscii());
 }
 
-// Wait until arduino finishes all command sent
-void MainWindow::waitCmdDone()
+// Wait until arduino finishes all commands sent
+bool MainWindow::waitCmdDone()
+{
+    return waitCmdDone(moveNo);
+}
+
+// Wait until arduino finishes queue queueNo. Returns false if limit switch
+// was reached before, the limit is reported just once.
+bool MainWindow::waitCmdDone(int queueNo)
 {
     if(preview)
-        return;
+        return true;
 
-    QString expect = "qdone" + QString::number(moveNo);
-    qDebug() << "expect=" << expect;
+    qDebug() << "expect qdone" << queueNo;
     for (;;) {
-        port.waitForReadyRead(10);
-        QByteArray str = port.read(1024);
+        if (link.queueDone() >= queueNo) {
+            return true;
+        }
+        if (link.limitReached()) {      // limit switch
+            QString tail = link.recentLog();
+            //QMessageBox::information(this, "Limit reached", tail);
+            qDebug() << "==============" << tail;
+            link.clearLimit();
+            return false;
+        }
+
+        QByteArray str = link.read(10);
         if (str.length() == 0) {
             continue;
         }
         qDebug() << "serial in=" << str;
-        for (int i = 0; i < str.count(); i++) {
-            char ch = str.at(i);
-            if ((ch >= 'a' && ch <= 'z') ||
-                (ch >= 'A' && ch <= 'Z') ||
-                (ch >= '0' && ch <= '9') || ch == ' ') {
-                serialLog.append(ch);
-            }
-        }
-        qDebug() << "serialLog=" << serialLog;
         ui->tbSerial->append(str);
         ui->tbSerial->update();
-
-        int index = serialLog.lastIndexOf(expect);
-        if (index >= 0) {
-            return;
-        }
-        if (serialLog.lastIndexOf("limit") >= 0) {      // limit switch
-            QString tail =
-                serialLog.count() < 1024 ? serialLog : serialLog.right(1024);
-            //QMessageBox::information(this, "Limit reached", tail);
-            qDebug() << "==============" << tail;
-            return;
-        }
     }
 }
 
@@ -478,7 +477,7 @@ void MainWindow::readSerial()
         QTimer::singleShot(100, this, SLOT(readSerial()));
         return;
     }
-    QByteArray data = port.readAll();
+    QByteArray data = link.read(0);
     qDebug() << data;
     ui->tbSerial->append(data);
     QTimer::singleShot(100, this, SLOT(readSerial()));
@@ -529,31 +528,33 @@ void MainWindow::mill()
 
     milling = true;
 
-    if(!QFile::exists("remaining.txt")) {
-        if(!QFile::copy(ui->tbModelFile->text(), "remaining.txt")) {
-            QMessageBox::critical(this, "Error", "Failed to copy shape.txt -> remaining.txt");
-            return;
-        }
-    }
-
-    QFile f("remaining.txt");
-    if (!f.open(QFile::ReadWrite)) {
+    QFile f(ui->tbModelFile->text());
+    if (!f.open(QFile::ReadOnly)) {
         QMessageBox::critical(this, "Error", "failed to load " + f.fileName() + ": " + f.errorString());
+        milling = false;
         return;
     }
 
-    for(;;)
+    // Continue interrupted job after the last queue arduino finished
+    JobJournal journal(JOURNAL_FILE, JOURNAL_SYNC_EVERY);
+    JobCheckpoint done;
+    if (journal.open(JobJournal::key(f), done)) {
+        f.seek(done.offset);
+        QMessageBox::information(this, "milling",
+            "Continuing interrupted job at byte " + QString::number(done.offset) +
+            ", machine should be at " + QString::number(done.x) + "," +
+            QString::number(done.y) + "," + QString::number(done.z));
+    }
+
+    // Next line is sent while previous one runs, it is journaled when
+    // arduino finishes it
+    int running = -1;
+    bool ok = true;
+    while (!f.atEnd())
     {
-        f.seek(0);
         QByteArray line = f.readLine().trimmed();
-        QByteArray rest = f.readAll();
-
         if(line.length() == 0)
         {
-            if(rest.length() == 0)
-            {
-                break;
-            }
             continue;
         }
 
@@ -561,17 +562,37 @@ void MainWindow::mill()
         cmdQueue.append(line);
         writeCmdQueue();
 
-        f.resize(rest.length());
-        f.seek(0);
-        if(f.write(rest) != rest.length())
-        {
-            QMessageBox::critical(this, "Error", "Failed write to remaining.txt");
+        // Queue without qdone must not be journaled, resume would skip it
+        if (running >= 0) {
+            ok = waitCmdDone(running);
+            if (!ok) {
+                break;
+            }
+            journal.append(done);
         }
-        waitCmdDone();
+        running = moveNo;
+
+        // Simulator already parsed the queue, its last x, y, z arguments
+        // are where machine will be in job coordinates (tx, ty, tz are
+        // motor steps)
+        done.offset = f.pos();
+        done.queueId = moveNo;
+        done.x = lastArg[0];
+        done.y = lastArg[1];
+        done.z = lastArg[2];
      }
+    if (ok && running >= 0) {
+        ok = waitCmdDone(running);
+    }
     f.close();
-    QFile::remove("remaining.txt");
     milling = false;
+    if (!ok) {
+        QMessageBox::critical(this, "milling", "Limit reached, job stopped. "
+                              "Run it again to continue after the last "
+                              "finished queue.");
+        return;
+    }
+    journal.remove();
     QMessageBox::information(this, "milling", "done!");
 }
 
@@ -16,6 +16,9 @@
 #include <QRegExp>
 #include <math.h>
 
+#include "cmdcodec.h"
+#include "cmdlink.h"
+#include "jobjournal.h"
 #include "qserialport.h"
 
 #define MILL_LOG_LEN 90000
@@ -42,8 +45,10 @@ public:
     QImage prn;
     QString imgFile;
     QSerialPort port;
-    QString serialLog;
+    CmdLink link;
+    CmdEncoder encoder;
     int moveNo;
+    quint8 simSeq;      // frame sequence number of simulator
     QStringList cmdQueue;
     bool milling;
     bool preview;
@@ -53,7 +58,8 @@ public:
 
     void sendCmd(QString cmd, bool flush = true);
     void writeCmdQueue();
-    void waitCmdDone();
+    bool waitCmdDone();
+    bool waitCmdDone(int queueNo);
     void move(int x, int y, int z);
     void moveBySvgCoord(int axis, qint64 pos, qint64 target, int driftX, bool justSetPos);
     void millShape(qint64 * x1, qint64 *y1, qint64 * x2, qint64 *y2,